@@ -0,0 +1,256 @@
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "apng.h"
+#include "lodepng.h"
+
+struct apng_frame {
+    unsigned x, y, w, h;
+    uint64_t time_ms;
+    std::vector<unsigned char> rgb;   // the changed rectangle
+};
+
+struct apng_writer {
+    unsigned width, height;
+    std::vector<unsigned char> prev;  // the picture as shown after the last frame
+    std::vector<apng_frame> frames;
+    std::unordered_map<uint32_t, unsigned char> palette;  // colour -> index
+    bool paletted;
+    unsigned captured;                // frames added, changed or not
+    uint64_t last_ms, step_ms;        // the last one added and the time since the one before
+};
+
+apng_writer *apng_create(unsigned width, unsigned height) {
+    apng_writer *aw = new apng_writer;
+    aw->width = width;
+    aw->height = height;
+    aw->prev.resize((size_t)width * height * 3);
+    aw->paletted = true;
+    aw->captured = 0;
+    aw->last_ms = aw->step_ms = 0;
+    return aw;
+}
+
+void apng_free(apng_writer *aw) {
+    delete aw;
+}
+
+unsigned apng_frames(const apng_writer *aw) {
+    return aw->frames.size();
+}
+
+int apng_paletted(const apng_writer *aw) {
+    return aw->paletted;
+}
+
+// Bounding box of the pixels that differ from prev, false if none do
+static bool changed_rect(const apng_writer *aw, const unsigned char *rgb,
+                         unsigned *x0, unsigned *y0, unsigned *x1, unsigned *y1) {
+    size_t stride = (size_t)aw->width * 3;
+    const unsigned char *prev = aw->prev.data();
+
+    unsigned top = 0, bottom = aw->height;
+    while (top < bottom && !std::memcmp(rgb + top * stride, prev + top * stride, stride)) top++;
+    if (top == bottom) return false;
+    while (!std::memcmp(rgb + (bottom - 1) * stride, prev + (bottom - 1) * stride, stride)) bottom--;
+
+    unsigned left = aw->width, right = 0;
+    for (unsigned y = top; y < bottom; y++) {
+        const unsigned char *a = rgb + y * stride, *b = prev + y * stride;
+        unsigned x = 0;
+        while (x < left && !std::memcmp(a + x * 3, b + x * 3, 3)) x++;
+        left = x;
+        x = aw->width;
+        while (x > right && !std::memcmp(a + (x - 1) * 3, b + (x - 1) * 3, 3)) x--;
+        right = x;
+    }
+    *x0 = left;
+    *y0 = top;
+    *x1 = right;
+    *y1 = bottom;
+    return true;
+}
+
+void apng_add_frame(apng_writer *aw, const unsigned char *rgb, uint64_t time_ms) {
+    if (aw->captured++) aw->step_ms = time_ms - aw->last_ms;
+    aw->last_ms = time_ms;
+
+    unsigned x0 = 0, y0 = 0, x1 = aw->width, y1 = aw->height;
+    if (!aw->frames.empty() && !changed_rect(aw, rgb, &x0, &y0, &x1, &y1)) return;
+
+    apng_frame f;
+    f.x = x0;
+    f.y = y0;
+    f.w = x1 - x0;
+    f.h = y1 - y0;
+    f.time_ms = time_ms;
+    f.rgb.resize((size_t)f.w * f.h * 3);
+
+    size_t stride = (size_t)aw->width * 3;
+    for (unsigned y = 0; y < f.h; y++) {
+        const unsigned char *src = rgb + (y0 + y) * stride + x0 * 3;
+        std::memcpy(&f.rgb[(size_t)y * f.w * 3], src, f.w * 3);
+        std::memcpy(&aw->prev[(y0 + y) * stride + x0 * 3], src, f.w * 3);
+    }
+
+    // new colours can only be in the changed rectangle
+    for (size_t i = 0; aw->paletted && i < f.rgb.size(); i += 3) {
+        uint32_t c = f.rgb[i] << 16 | f.rgb[i + 1] << 8 | f.rgb[i + 2];
+        if (aw->palette.count(c)) continue;
+        if (aw->palette.size() == 256) {
+            aw->paletted = false;
+            aw->palette.clear();
+            break;
+        }
+        unsigned char index = aw->palette.size();
+        aw->palette[c] = index;
+    }
+
+    aw->frames.push_back(std::move(f));
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void put16(unsigned char *p, unsigned v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+// Encodes one rectangle as a PNG and collects its zlib stream and, for
+// the first frame, the IHDR and PLTE chunks
+static unsigned encode_frame(const apng_writer *aw, const apng_frame &f,
+                             const std::vector<uint32_t> &colors,
+                             std::vector<unsigned char> &idat,
+                             std::vector<unsigned char> *header) {
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.encoder.auto_convert = 0;
+
+    std::vector<unsigned char> indices;
+    const unsigned char *image = f.rgb.data();
+    if (aw->paletted) {
+        state.info_raw.colortype = LCT_PALETTE;
+        state.info_png.color.colortype = LCT_PALETTE;
+        for (uint32_t c : colors) {
+            lodepng_palette_add(&state.info_raw, c >> 16, (c >> 8) & 0xFF, c & 0xFF, 255);
+            lodepng_palette_add(&state.info_png.color, c >> 16, (c >> 8) & 0xFF, c & 0xFF, 255);
+        }
+        indices.resize((size_t)f.w * f.h);
+        for (size_t i = 0; i < indices.size(); i++) {
+            const unsigned char *p = &f.rgb[i * 3];
+            indices[i] = aw->palette.at(p[0] << 16 | p[1] << 8 | p[2]);
+        }
+        image = indices.data();
+    } else {
+        state.info_raw.colortype = LCT_RGB;
+        state.info_png.color.colortype = LCT_RGB;
+    }
+    state.info_raw.bitdepth = 8;
+    state.info_png.color.bitdepth = 8;
+
+    unsigned char *png = nullptr;
+    size_t pngsize = 0;
+    unsigned error = lodepng_encode(&png, &pngsize, image, f.w, f.h, &state);
+    lodepng_state_cleanup(&state);
+    if (error) return error;
+
+    idat.clear();
+    const unsigned char *end = png + pngsize;
+    for (const unsigned char *chunk = png + 8; chunk + 12 <= end; chunk = lodepng_chunk_next_const(chunk)) {
+        unsigned len = lodepng_chunk_length(chunk);
+        if (lodepng_chunk_type_equals(chunk, "IDAT")) {
+            const unsigned char *data = lodepng_chunk_data_const(chunk);
+            idat.insert(idat.end(), data, data + len);
+        } else if (header && (lodepng_chunk_type_equals(chunk, "IHDR") ||
+                              lodepng_chunk_type_equals(chunk, "PLTE"))) {
+            header->insert(header->end(), chunk, chunk + len + 12);
+        }
+        if (lodepng_chunk_type_equals(chunk, "IEND")) break;
+    }
+    std::free(png);
+    return 0;
+}
+
+unsigned apng_encode(apng_writer *aw, unsigned char **out, size_t *outsize) {
+    *out = nullptr;
+    *outsize = 0;
+    if (aw->frames.empty()) return 48;  // lodepng's "empty input"
+
+    std::vector<uint32_t> colors(aw->palette.size());
+    for (auto &entry : aw->palette) colors[entry.second] = entry.first;
+
+    unsigned char *png = (unsigned char *)std::malloc(8);
+    static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    std::memcpy(png, signature, 8);
+    size_t size = 8;
+
+    std::vector<unsigned char> header, idat;
+    unsigned error = encode_frame(aw, aw->frames[0], colors, idat, &header);
+
+    // IHDR, then acTL ahead of PLTE and the image data
+    unsigned ihdr_len = 0;
+    if (!error) {
+        ihdr_len = lodepng_chunk_length(header.data()) + 12;
+        error = lodepng_chunk_append(&png, &size, header.data());
+    }
+    if (!error) {
+        unsigned char actl[8];
+        put32(actl, aw->frames.size());
+        put32(actl + 4, 0);   // loop forever
+        error = lodepng_chunk_create(&png, &size, 8, "acTL", actl);
+    }
+    if (!error && header.size() > ihdr_len)
+        error = lodepng_chunk_append(&png, &size, header.data() + ihdr_len);
+
+    unsigned seq = 0;
+    for (size_t i = 0; !error && i < aw->frames.size(); i++) {
+        const apng_frame &f = aw->frames[i];
+        if (i) error = encode_frame(aw, f, colors, idat, nullptr);
+        if (error) break;
+
+        // the last frame lasts to the last capture and one interval past it,
+        // however many of the captures before that changed nothing
+        uint64_t delay;
+        if (i + 1 < aw->frames.size()) delay = aw->frames[i + 1].time_ms - f.time_ms;
+        else if (aw->captured > 1) delay = aw->last_ms - f.time_ms + aw->step_ms;
+        else delay = 100;
+        if (delay > 65535) delay = 65535;
+
+        unsigned char fctl[26];
+        put32(fctl, seq++);
+        put32(fctl + 4, f.w);
+        put32(fctl + 8, f.h);
+        put32(fctl + 12, f.x);
+        put32(fctl + 16, f.y);
+        put16(fctl + 20, delay);
+        put16(fctl + 22, 1000);
+        fctl[24] = 0;   // APNG_DISPOSE_OP_NONE
+        fctl[25] = 0;   // APNG_BLEND_OP_SOURCE
+        error = lodepng_chunk_create(&png, &size, 26, "fcTL", fctl);
+        if (error) break;
+
+        if (!i) {
+            error = lodepng_chunk_create(&png, &size, idat.size(), "IDAT", idat.data());
+        } else {
+            idat.insert(idat.begin(), 4, 0);
+            put32(idat.data(), seq++);
+            error = lodepng_chunk_create(&png, &size, idat.size(), "fdAT", idat.data());
+        }
+    }
+    if (!error) error = lodepng_chunk_create(&png, &size, 0, "IEND", nullptr);
+
+    if (error) {
+        std::free(png);
+        return error;
+    }
+    *out = png;
+    *outsize = size;
+    return 0;
+}
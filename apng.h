@@ -0,0 +1,33 @@
+/*
+Animated PNG writer.  Every frame after the first is stored as the rectangle
+that changed since the previous one (fcTL/fdAT with blend SOURCE, dispose
+NONE), frames that change nothing only lengthen the one before, and when
+the whole clip has at most 256 colours every frame shares one PLTE.  Encode
+time follows the changed pixels, not frames times frame size.
+*/
+
+#ifndef APNG_H
+#define APNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct apng_writer;
+
+apng_writer *apng_create(unsigned width, unsigned height);
+void apng_free(apng_writer *aw);
+
+// Adds an RGB24 frame captured at time_ms; a frame's delay is the time to
+// the next one that changed, the last one lasts to the last frame added plus
+// the interval before that (100 ms for a single frame).
+void apng_add_frame(apng_writer *aw, const unsigned char *rgb, uint64_t time_ms);
+
+// Number of frames that differ from the one before them
+unsigned apng_frames(const apng_writer *aw);
+// 1 when the clip fits a palette so far
+int apng_paletted(const apng_writer *aw);
+
+// Builds the file, returns a lodepng error code
+unsigned apng_encode(apng_writer *aw, unsigned char **out, size_t *outsize);
+
+#endif
@@ -0,0 +1,42 @@
+/*
+C++ wrapper around mister_scaler: owns the mapping for its lifetime and
+exposes the header, pixel format and frame consistent reads.
+*/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "scaler.h"
+
+class mister_capture {
+public:
+   mister_capture() : ms(mister_scaler_init()) {}
+   ~mister_capture() { mister_scaler_free(ms); }
+
+   mister_capture(const mister_capture &) = delete;
+   mister_capture &operator=(const mister_capture &) = delete;
+   mister_capture(mister_capture &&o) : ms(o.ms) { o.ms = nullptr; }
+
+   explicit operator bool() const { return ms != nullptr; }
+   mister_scaler *get() const { return ms; }
+   mister_scaler *operator->() const { return ms; }
+
+   const mister_pixfmt &format() const { return ms->pixfmt; }
+   volatile unsigned char *buffer() const { return mister_scaler_buffer(ms); }
+   const unsigned char *pixels() const { return mister_scaler_pixels(ms); }
+   const unsigned char *row(int y) const { return pixels() + y * ms->line; }
+
+   bool refresh() { return mister_scaler_refresh(ms) != 0; }
+   int flags() const { return mister_scaler_flags(ms); }
+   int frame_counter() const { return mister_scaler_frame_counter(ms); }
+   int wait_frame(int timeout_ms) { return mister_scaler_wait_frame(ms, timeout_ms); }
+
+   // true when the copy was frame consistent
+   bool read_rgb24(unsigned char *out) { return mister_scaler_read(ms, out) == 0; }
+   bool read_bgra(unsigned char *out) { return mister_scaler_read_32(ms, out) == 0; }
+
+private:
+   mister_scaler *ms;
+};
+
+#endif
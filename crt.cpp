@@ -0,0 +1,181 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crt.h"
+
+struct mister_crt {
+    int src_w, src_h, scale;
+    int dst_w;
+    unsigned char *row;     // a converted source row
+    // the source row widened, with one pixel repeated at each end for the blur
+    unsigned char *wide;
+    unsigned char *line;    // the widened row blurred
+    // weights of the left, own and right pixel of every output byte, out of
+    // 256, NULL without blur
+    uint16_t *wl, *wc, *wr;
+    uint16_t bright[MISTER_CRT_MAX_SCALE];  // of every line of a source row, out of 256
+};
+
+mister_crt *mister_crt_create(int src_w, int src_h, const mister_crt_opts *opts)
+{
+    int s = opts->scale;
+    if (src_w <= 0 || src_h <= 0 || s < 1 || s > MISTER_CRT_MAX_SCALE ||
+        opts->scanline < 0 || opts->scanline > 100 || opts->blur < 0 || opts->blur > 100)
+        return NULL;
+
+    mister_crt *crt = (mister_crt *)calloc(1, sizeof(mister_crt));
+    if (!crt) return NULL;
+    crt->src_w = src_w;
+    crt->src_h = src_h;
+    crt->scale = s;
+    crt->dst_w = src_w * s;
+    size_t n = (size_t)crt->dst_w * 3;
+    crt->row = (unsigned char *)malloc((size_t)src_w * 3);
+    crt->wide = (unsigned char *)malloc(n + 6);
+    crt->line = (unsigned char *)malloc(n);
+    bool ok = crt->row && crt->wide && crt->line;
+
+    // blur 100 puts the edge halfway to the neighbour, at 1x both edges share it
+    if (ok && opts->blur) {
+        crt->wl = (uint16_t *)malloc(n * sizeof(uint16_t));
+        crt->wc = (uint16_t *)malloc(n * sizeof(uint16_t));
+        crt->wr = (uint16_t *)malloc(n * sizeof(uint16_t));
+        ok = crt->wl && crt->wc && crt->wr;
+        int edge = opts->blur * 128 / 100;
+        for (size_t i = 0; ok && i < n; i++) {
+            int k = (int)(i / 3 % s);
+            int l = 0, r = 0;
+            if (s == 1) {
+                l = r = edge / 2;
+            } else if (k == 0) {
+                l = edge;
+            } else if (k == s - 1) {
+                r = edge;
+            }
+            crt->wl[i] = l;
+            crt->wr[i] = r;
+            crt->wc[i] = 256 - l - r;
+        }
+    }
+
+    // the last lines of every source row are the gap between scanlines
+    int dark = s / 3 ? s / 3 : 1;
+    for (int k = 0; k < s; k++)
+        crt->bright[k] = s > 1 && k >= s - dark ? 256 - opts->scanline * 256 / 100 : 256;
+
+    if (!ok) {
+        mister_crt_free(crt);
+        return NULL;
+    }
+    return crt;
+}
+
+void mister_crt_free(mister_crt *crt)
+{
+    if (!crt) return;
+    free(crt->row);
+    free(crt->wide);
+    free(crt->line);
+    free(crt->wl);
+    free(crt->wc);
+    free(crt->wr);
+    free(crt);
+}
+
+// Every pixel repeated scale times, 2x gets its own loop
+static void widen(const unsigned char *src, unsigned char *dst, int src_w, int scale)
+{
+    if (scale == 2) {
+        for (int x = 0; x < src_w; x++) {
+            dst[0] = dst[3] = src[0];
+            dst[1] = dst[4] = src[1];
+            dst[2] = dst[5] = src[2];
+            src += 3;
+            dst += 6;
+        }
+        return;
+    }
+    for (int x = 0; x < src_w; x++) {
+        for (int k = 0; k < scale; k++) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            dst += 3;
+        }
+        src += 3;
+    }
+}
+
+// The row of output bytes for one source row, before the scanlines
+static const unsigned char *expand(mister_crt *crt, const unsigned char *src)
+{
+    int n = crt->dst_w * 3;
+    unsigned char *e = crt->wide + 3;
+    if (crt->scale == 1 && !crt->wl) return src;
+    widen(src, e, crt->src_w, crt->scale);
+    if (!crt->wl) return e;
+
+    memcpy(crt->wide, e, 3);
+    memcpy(e + n, e + n - 3, 3);
+    const uint16_t *wl = crt->wl, *wc = crt->wc, *wr = crt->wr;
+    unsigned char *out = crt->line;
+    for (int i = 0; i < n; i++)
+        out[i] = (wl[i] * e[i - 3] + wc[i] * e[i] + wr[i] * e[i + 3] + 128) >> 8;
+    return out;
+}
+
+void mister_crt_run(mister_crt *crt, mister_row_fn row, void *ctx, unsigned char *dst, int stride)
+{
+    int n = crt->dst_w * 3;
+    for (int y = 0; y < crt->src_h; y++) {
+        const unsigned char *line = expand(crt, row(ctx, y, crt->row));
+        for (int k = 0; k < crt->scale; k++) {
+            unsigned char *out = dst + (size_t)(y * crt->scale + k) * stride;
+            uint32_t b = crt->bright[k];
+            if (b == 256) {
+                memcpy(out, line, n);
+                continue;
+            }
+            for (int i = 0; i < n; i++)
+                out[i] = (line[i] * b + 128) >> 8;
+        }
+    }
+}
+
+struct packed_picture {
+    const unsigned char *src;
+    size_t stride;
+};
+
+static const unsigned char *packed_row(void *ctx, int y, unsigned char *)
+{
+    const packed_picture *p = (const packed_picture *)ctx;
+    return p->src + y * p->stride;
+}
+
+void mister_crt_rgb24(mister_crt *crt, const unsigned char *src, unsigned char *dst, int stride)
+{
+    packed_picture p = { src, (size_t)crt->src_w * 3 };
+    mister_crt_run(crt, packed_row, &p, dst, stride);
+}
+
+int mister_crt_parse(const char *s, mister_crt_opts *opts)
+{
+    opts->scanline = 40;
+    opts->blur = 0;
+    int *field[3] = { &opts->scale, &opts->scanline, &opts->blur };
+    for (int i = 0; i < 3; i++) {
+        int used;
+        if (sscanf(s, "%d%n", field[i], &used) != 1) return -1;
+        s += used;
+        if (*s != ',') break;
+        s++;
+    }
+    // nothing may follow the last number
+    if (*s || opts->scale < 1 || opts->scale > MISTER_CRT_MAX_SCALE ||
+        opts->scanline < 0 || opts->scanline > 100 || opts->blur < 0 || opts->blur > 100)
+        return -1;
+    return 0;
+}
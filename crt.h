@@ -0,0 +1,41 @@
+/*
+CRT look for captures: integer upscaling with darkened scanlines and an
+optional horizontal blur that softens the pixel edges the way the beam did,
+so a screenshot or recording looks like the HDMI output rather than the
+core's raw pixels.  Every source row is widened and blurred once, then its
+scale output rows are that row at the brightness of their line.  Both steps
+are plain loops over whole rows against tables made once per size, so they
+vectorize like the resampler, and each source row is written out as soon
+as it is read (mister_scaler_read_crt).
+*/
+
+#ifndef CRT_H
+#define CRT_H
+
+#include "resample.h"
+
+#define MISTER_CRT_MAX_SCALE 8
+
+typedef struct {
+   int scale;      // integer factor, 1 to MISTER_CRT_MAX_SCALE
+   int scanline;   // percent the scanlines lose, 0 for none, needs scale 2 or more
+   int blur;       // percent of the neighbour mixed into the edge of each pixel
+} mister_crt_opts;
+
+struct mister_crt;
+
+// The output is src_w*scale x src_h*scale RGB24
+mister_crt *mister_crt_create(int src_w, int src_h, const mister_crt_opts *opts);
+void mister_crt_free(mister_crt *crt);
+
+// Rows come from row() in order, like mister_resample; stride is the byte
+// distance between output rows
+void mister_crt_run(mister_crt *crt, mister_row_fn row, void *ctx, unsigned char *dst, int stride);
+// The same for a packed RGB24 picture in memory
+void mister_crt_rgb24(mister_crt *crt, const unsigned char *src, unsigned char *dst, int stride);
+
+// "SCALE[,SCANLINE[,BLUR]]", e.g. "2" or "3,50,30"; scanlines default to 40
+// percent and blur to none.  Returns 0 when valid.
+int mister_crt_parse(const char *s, mister_crt_opts *opts);
+
+#endif
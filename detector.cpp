@@ -0,0 +1,166 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "detector.h"
+
+static const char *names[DETECT_COUNT] = { "static", "black", "dominant" };
+
+const char *detector_name(int rule) {
+    return (rule >= 0 && rule < DETECT_COUNT) ? names[rule] : "unknown";
+}
+
+void detector_defaults(detector_config *cfg) {
+    std::memset(cfg, 0, sizeof(*cfg));
+
+    // at most 1% of the samples moving counts as a still screen
+    cfg->rule[DETECT_STATIC]   = { true, 0.99, 0.95, 120.0, 2.0 };
+    cfg->rule[DETECT_BLACK]    = { true, 0.95, 0.85,   5.0, 1.0 };
+    cfg->rule[DETECT_DOMINANT] = { true, 0.90, 0.80,  30.0, 2.0 };
+    cfg->black_level = 24;
+    cfg->signal_on   = SIGUSR1;
+    cfg->signal_off  = SIGUSR2;
+}
+
+int detector_init(detector *d, const detector_config *cfg, int samples) {
+    std::memset(d, 0, sizeof(*d));
+    d->cfg = *cfg;
+    d->count = samples;
+    d->prev = (uint32_t*)std::calloc(samples, sizeof(uint32_t));
+    return d->prev != nullptr;
+}
+
+void detector_free(detector *d) {
+    std::free(d->prev);
+    d->prev = nullptr;
+}
+
+void detector_measure(detector *d, const uint32_t *samples, detector_stats *st) {
+    uint64_t hash = 1469598103934665603ULL;
+    const uint64_t prime = 1099511628211ULL;
+    uint32_t counts[4096];
+    std::memset(counts, 0, sizeof(counts));
+
+    int still = 0, black = 0;
+    int level = d->cfg.black_level;
+    for (int i = 0; i < d->count; i++) {
+        uint32_t c = samples[i];
+        int r = (c >> 16) & 0xFF;
+        int g = (c >> 8) & 0xFF;
+        int b = c & 0xFF;
+
+        hash ^= c;
+        hash *= prime;
+        if (d->have_prev && d->prev[i] == c) still++;
+        // integer BT.601 luma
+        if (((77 * r + 150 * g + 29 * b) >> 8) <= level) black++;
+        counts[((r >> 4) << 8) | ((g >> 4) << 4) | (b >> 4)]++;
+    }
+
+    int best = 0;
+    for (int i = 1; i < 4096; ++i) {
+        if (counts[i] > counts[best]) best = i;
+    }
+
+    double n = d->count ? d->count : 1;
+    st->hash     = hash;
+    st->color    = (((best >> 8) & 0xF) * 17) << 16 |
+                   (((best >> 4) & 0xF) * 17) << 8 |
+                   (best & 0xF) * 17;
+    st->still    = still / n;
+    st->black    = black / n;
+    st->dominant = counts[best] / n;
+
+    std::memcpy(d->prev, samples, d->count * sizeof(uint32_t));
+    d->have_prev = true;
+}
+
+// Double fork so the peeper never has to reap the command.
+static void run_command(const char *cmd, const char *event, bool on) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::fprintf(stderr, "detector: fork failed: %s\n", std::strerror(errno));
+        return;
+    }
+    if (pid == 0) {
+        if (fork() == 0) {
+            setenv("DETECT_EVENT", event, 1);
+            setenv("DETECT_STATE", on ? "on" : "off", 1);
+            execl("/bin/sh", "sh", "-c", cmd, (char*)nullptr);
+            _exit(127);
+        }
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+static void write_flag(const char *dir, const char *event, bool on) {
+    char path[4096];
+    std::snprintf(path, sizeof(path), "%s/%s", dir, event);
+    if (!on) {
+        if (unlink(path) < 0 && errno != ENOENT)
+            std::fprintf(stderr, "detector: unable to remove %s\n", path);
+        return;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::fprintf(stderr, "detector: unable to create %s\n", path);
+        return;
+    }
+    close(fd);
+}
+
+static void send_signal(const char *pidfile, int sig) {
+    FILE *f = std::fopen(pidfile, "r");
+    if (!f) return;
+    int pid = 0;
+    if (std::fscanf(f, "%d", &pid) == 1 && pid > 0) {
+        if (kill(pid, sig) < 0)
+            std::fprintf(stderr, "detector: kill(%d) failed: %s\n", pid, std::strerror(errno));
+    }
+    std::fclose(f);
+}
+
+static void transition(detector *d, int rule, bool on) {
+    const detector_config *cfg = &d->cfg;
+    const char *event = names[rule];
+
+    std::fprintf(stderr, "\ndetector: %s %s\n", event, on ? "on" : "off");
+    if (cfg->flag_dir) write_flag(cfg->flag_dir, event, on);
+    if (cfg->pidfile)  send_signal(cfg->pidfile, on ? cfg->signal_on : cfg->signal_off);
+    if (cfg->command)  run_command(cfg->command, event, on);
+}
+
+int detector_update(detector *d, const detector_stats *st, double now) {
+    const double value[DETECT_COUNT] = { st->still, st->black, st->dominant };
+    int mask = 0;
+
+    for (int i = 0; i < DETECT_COUNT; i++) {
+        const detector_rule *r = &d->cfg.rule[i];
+        detector_state *s = &d->state[i];
+        if (!r->enabled) continue;
+
+        // the exit threshold only applies once active, that is the hysteresis band
+        bool raw = value[i] >= (s->active ? r->exit : r->enter);
+        if (raw != s->raw) {
+            s->raw = raw;
+            s->since = now;
+        }
+
+        if (!s->active && raw && now - s->since >= r->hold_secs) {
+            s->active = true;
+            transition(d, i, true);
+        } else if (s->active && !raw && now - s->since >= r->release_secs) {
+            s->active = false;
+            transition(d, i, false);
+        }
+        if (s->active) mask |= 1 << i;
+    }
+    return mask;
+}
@@ -0,0 +1,78 @@
+/*
+Static-screen / burn-in detector used by mister_peeper.
+
+The peeper samples a sparse grid of pixels every poll and hands the grid
+to the detector.  Each rule (static, black, dominant colour) has an enter
+threshold, a lower exit threshold and hold/release times, so a rule only
+toggles after its condition has been stable for a while.  Transitions run
+the configured actions.
+*/
+
+#ifndef DETECTOR_H
+#define DETECTOR_H
+
+#include <stdint.h>
+
+enum {
+   DETECT_STATIC,
+   DETECT_BLACK,
+   DETECT_DOMINANT,
+   DETECT_COUNT
+};
+
+typedef struct {
+   bool   enabled;
+   double enter;         // raw condition turns on at >= enter
+   double exit;          // and back off below exit (exit <= enter)
+   double hold_secs;     // condition must hold this long to activate
+   double release_secs;  // and be absent this long to deactivate
+} detector_rule;
+
+typedef struct {
+   detector_rule rule[DETECT_COUNT];
+   int    black_level;   // max luma (0-255) of a sample counted as black
+
+   const char *command;  // run with /bin/sh -c, DETECT_EVENT/DETECT_STATE set
+   const char *flag_dir; // <flag_dir>/<event> exists while a rule is active
+   const char *pidfile;  // pid that gets signal_on / signal_off
+   int    signal_on;
+   int    signal_off;
+} detector_config;
+
+// Per-poll measurements, all fractions are 0..1 of the sample count
+typedef struct {
+   uint64_t hash;        // FNV-1a over the samples
+   uint32_t color;       // dominant colour, 0xRRGGBB
+   double   still;       // samples unchanged since the previous poll
+   double   black;       // samples at or below black_level
+   double   dominant;    // samples in the dominant colour bucket
+} detector_stats;
+
+typedef struct {
+   bool   active;
+   bool   raw;
+   double since;         // time raw last changed
+} detector_state;
+
+typedef struct {
+   detector_config cfg;
+   detector_state  state[DETECT_COUNT];
+   uint32_t *prev;       // previous sample grid
+   int       count;
+   bool      have_prev;
+} detector;
+
+void detector_defaults(detector_config *cfg);
+int  detector_init(detector *d, const detector_config *cfg, int samples);
+void detector_free(detector *d);
+
+// samples are 0xRRGGBB values, count must match detector_init
+void detector_measure(detector *d, const uint32_t *samples, detector_stats *st);
+
+// Feeds one poll into the rules, runs actions on transitions and returns
+// a bitmask of the active rules.
+int  detector_update(detector *d, const detector_stats *st, double now);
+
+const char *detector_name(int rule);
+
+#endif
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "fake_ascal.h"
+#include "scaler.h"
+
+#define FAKE_HEADER_SIZE 256
+
+struct fake_ascal {
+    fake_ascal_config cfg;
+    mister_pixfmt pf;
+    int line;
+    int fd;
+    unsigned char *map;
+    size_t size;
+
+    std::atomic<uint32_t> frames;
+    std::atomic<uint32_t> skipped;
+    std::atomic<bool> running;
+    std::thread thread;
+};
+
+void fake_ascal_defaults(fake_ascal_config *cfg) {
+    std::memset(cfg, 0, sizeof(*cfg));
+    cfg->width  = 320;
+    cfg->height = 240;
+    cfg->format = 0x02; // RGB888
+    cfg->hz     = 60.0;
+    cfg->hold   = 1;
+}
+
+static int create_memfd() {
+#ifdef SYS_memfd_create
+    int fd = syscall(SYS_memfd_create, "fake_ascal", 1 /* MFD_CLOEXEC */);
+    if (fd >= 0) return fd;
+#endif
+    char path[] = "/tmp/fake_ascal.XXXXXX";
+    int fd2 = mkstemp(path);
+    if (fd2 >= 0) unlink(path);
+    return fd2;
+}
+
+fake_ascal *fake_ascal_create(const char *path, const fake_ascal_config *cfg) {
+    mister_pixfmt pf = mister_pixfmt_decode(cfg->format);
+    // keep rows 16 byte aligned like the scaler does
+    int line = (cfg->width * pf.bpp + 15) & ~15;
+    if (!pf.bpp || cfg->width <= 0 || cfg->height <= 0 ||
+        FAKE_HEADER_SIZE + cfg->height * line > MISTER_SCALER_BUFFERSIZE) {
+        std::fprintf(stderr, "fake_ascal: %dx%d %s does not fit the buffer\n",
+                     cfg->width, cfg->height, pf.name);
+        return nullptr;
+    }
+
+    int fd = path ? open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)
+                  : create_memfd();
+    if (fd < 0) {
+        std::fprintf(stderr, "fake_ascal: unable to create %s: %s\n",
+                     path ? path : "memfd", std::strerror(errno));
+        return nullptr;
+    }
+
+    size_t size = cfg->triple ? MISTER_SCALER_TRIPLE_SIZE : MISTER_SCALER_BUFFERSIZE;
+    if (ftruncate(fd, size) < 0) {
+        std::fprintf(stderr, "fake_ascal: ftruncate failed: %s\n", std::strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        std::fprintf(stderr, "fake_ascal: mmap failed: %s\n", std::strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+
+    fake_ascal *fa = new fake_ascal;
+    fa->cfg = *cfg;
+    if (!fa->cfg.output_width)  fa->cfg.output_width  = cfg->width;
+    if (!fa->cfg.output_height) fa->cfg.output_height = cfg->height;
+    if (fa->cfg.hold < 1) fa->cfg.hold = 1;
+    if (cfg->stamp && (cfg->width < 32 || cfg->height < FAKE_ASCAL_STAMP_ROWS))
+        std::fprintf(stderr, "fake_ascal: %dx%d is too small for a frame stamp\n", cfg->width, cfg->height);
+    fa->pf = pf;
+    fa->line = line;
+    fa->fd = fd;
+    fa->map = (unsigned char *)map;
+    fa->size = size;
+    fa->frames = 0;
+    fa->skipped = 0;
+    fa->running = false;
+
+    // a first frame, so readers find a valid header straight away
+    fake_ascal_step(fa);
+    return fa;
+}
+
+void fake_ascal_free(fake_ascal *fa) {
+    if (!fa) return;
+    fake_ascal_stop(fa);
+    munmap(fa->map, fa->size);
+    close(fa->fd);
+    delete fa;
+}
+
+int fake_ascal_fd(fake_ascal *fa) {
+    return fa->fd;
+}
+
+uint32_t fake_ascal_frames(fake_ascal *fa) {
+    return fa->frames;
+}
+
+uint32_t fake_ascal_skipped(fake_ascal *fa) {
+    return fa->skipped;
+}
+
+// The stamp blocks are width/32 pixels wide
+static bool stamp_pixel(const fake_ascal_config *cfg, uint32_t n, int x, int y, uint32_t *c) {
+    int bw = cfg->width / 32;
+    if (!cfg->stamp || !bw || cfg->height < FAKE_ASCAL_STAMP_ROWS ||
+        y >= FAKE_ASCAL_STAMP_ROWS || x >= 32 * bw)
+        return false;
+    uint32_t v = y < FAKE_ASCAL_STAMP_ROWS / 2 ? n : ~n;
+    *c = (v >> (31 - x / bw)) & 1 ? 0xFFFFFF : 0x000000;
+    return true;
+}
+
+int fake_ascal_read_stamp(const unsigned char *luma, int stride, int width, int height, uint32_t *n) {
+    int bw = width / 32;
+    const int band = FAKE_ASCAL_STAMP_ROWS / 2;
+    if (!bw || height < FAKE_ASCAL_STAMP_ROWS) return -1;
+
+    // the middle of every block, away from the edges a lossy codec smears
+    uint32_t v[2] = { 0, 0 };
+    for (int b = 0; b < 2; b++) {
+        for (int bit = 0; bit < 32; bit++) {
+            int x0 = bit * bw + bw / 4, x1 = bit * bw + bw - bw / 4;
+            int sum = 0, count = 0;
+            for (int y = b * band + band / 4; y < (b + 1) * band - band / 4; y++) {
+                for (int x = x0; x < x1; x++) {
+                    sum += luma[y * stride + x];
+                    count++;
+                }
+            }
+            v[b] = v[b] << 1 | (sum >= 128 * count);
+        }
+    }
+    if (v[0] != ~v[1]) return -1;
+    *n = v[0];
+    return 0;
+}
+
+// 16x16 tiles from a small palette scrolling left, with a white box
+// bouncing across, which compresses about like a real 2D game screen.
+uint32_t fake_ascal_pixel(const fake_ascal_config *cfg, uint32_t n, int x, int y) {
+    static const uint32_t palette[16] = {
+        0x000000, 0x1D2B53, 0x7E2553, 0x008751, 0xAB5236, 0x5F574F, 0xC2C3C7, 0xFFF1E8,
+        0xFF004D, 0xFFA300, 0xFFEC27, 0x00E436, 0x29ADFF, 0x83769C, 0xFF77A8, 0xFFCCAA
+    };
+    uint32_t c;
+    if (stamp_pixel(cfg, n, x, y, &c)) return c;
+    uint32_t pic = n / cfg->hold;
+
+    int bx = pic % (cfg->width > 32 ? cfg->width - 32 : 1);
+    int by = (pic * 3) % (cfg->height > 32 ? cfg->height - 32 : 1);
+    if (x >= bx && x < bx + 32 && y >= by && y < by + 32) return 0xFFFFFF;
+
+    uint32_t tx = (x + pic) >> 4, ty = y >> 4;
+    uint32_t h = (tx * 73856093u) ^ (ty * 19349663u);
+    return palette[(h >> 7) & 15];
+}
+
+static void encode_pixel(uint32_t c, const mister_pixfmt *pf, unsigned char *out) {
+    int r = (c >> 16) & 0xFF, g = (c >> 8) & 0xFF, b = c & 0xFF;
+    switch (pf->bpp) {
+        case 1:
+            out[0] = (77 * r + 150 * g + 29 * b) >> 8;
+            break;
+        case 2: {
+            if (pf->bgr) { int tmp = r; r = b; b = tmp; }
+            int v = pf->rgb1555 ? (r >> 3) << 10 | (g >> 3) << 5 | b >> 3
+                                : (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+            out[0] = v;
+            out[1] = v >> 8;
+            break;
+        }
+        default:
+            out[0] = pf->bgr ? b : r;
+            out[1] = g;
+            out[2] = pf->bgr ? r : b;
+            if (pf->bpp == 4) out[3] = 0xFF;
+            break;
+    }
+}
+
+// Frame n into its buffer, only the header when pixels is false
+static void write_frame(fake_ascal *fa, uint32_t n, bool pixels) {
+    const fake_ascal_config *cfg = &fa->cfg;
+    int index = cfg->triple ? n % 3 : 0;
+    unsigned char *base = fa->map + index * MISTER_SCALER_TRIPLE_STRIDE;
+    volatile unsigned char *hdr = base;
+
+    // the scaler updates the header before it writes the frame
+    int flags = (cfg->flags & 0x0F) | (cfg->triple ? MISTER_SCALER_TRIPLE : 0);
+    // interlaced, every frame is one field of a picture twice as high
+    int field = -1;
+    if (cfg->flags & MISTER_SCALER_INTERLACED) {
+        field = n & 1;
+        flags = (flags & ~MISTER_SCALER_FIELD) | (field ? MISTER_SCALER_FIELD : 0);
+    }
+    hdr[0]  = 1;
+    hdr[1]  = 1;
+    hdr[2]  = FAKE_HEADER_SIZE >> 8;
+    hdr[3]  = FAKE_HEADER_SIZE & 0xFF;
+    hdr[4]  = cfg->format;
+    hdr[6]  = cfg->width >> 8;
+    hdr[7]  = cfg->width;
+    hdr[8]  = cfg->height >> 8;
+    hdr[9]  = cfg->height;
+    hdr[10] = fa->line >> 8;
+    hdr[11] = fa->line;
+    hdr[12] = cfg->output_width >> 8;
+    hdr[13] = cfg->output_width;
+    hdr[14] = cfg->output_height >> 8;
+    hdr[15] = cfg->output_height;
+    hdr[5]  = flags | (n & 0x07) << 5;
+    if (!pixels) return;
+
+    for (int y = 0; y < cfg->height; y++) {
+        unsigned char *row = base + FAKE_HEADER_SIZE + y * fa->line;
+        int py = field < 0 ? y : 2 * y + field;
+        const unsigned char *src = cfg->image ? cfg->image + (py % cfg->height) * cfg->width * 3 : nullptr;
+        for (int x = 0; x < cfg->width; x++) {
+            uint32_t c;
+            if (!src)
+                c = fake_ascal_pixel(cfg, n, x, py);
+            else if (!stamp_pixel(cfg, n, x, py, &c))
+                c = (uint32_t)src[0] << 16 | src[1] << 8 | src[2];
+            encode_pixel(c, &fa->pf, row);
+            row += fa->pf.bpp;
+            if (src) src += 3;
+        }
+    }
+}
+
+void fake_ascal_step(fake_ascal *fa) {
+    uint32_t n = fa->frames;
+    write_frame(fa, n, true);
+    fa->frames = n + 1;
+}
+
+int fake_ascal_start(fake_ascal *fa) {
+    if (fa->running) return 1;
+    fa->running = true;
+    fa->thread = std::thread([fa]() {
+        const fake_ascal_config *cfg = &fa->cfg;
+        // above the recorder's capture thread (SCHED_FIFO 10), which would
+        // otherwise get in halfway through a frame on a single core and read
+        // it half drawn; the scaler is never held up by the ARM either.
+        // Quietly stays put without the rights.
+        struct sched_param sp;
+        std::memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = 20;
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+        int64_t period = (int64_t)(1e9 / cfg->hz);
+        // jitter moves single frames around the exact schedule, it never adds up
+        int64_t jitter = std::min<int64_t>((int64_t)cfg->jitter_us * 1000, period / 2);
+        std::minstd_rand rng(1);
+        std::uniform_int_distribution<int64_t> offset(-jitter, jitter);
+
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        int64_t due = (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+        uint32_t since_stall = 0, stalled = 0;
+        while (fa->running) {
+            due += period;
+            if (cfg->stall_every && ++since_stall >= (uint32_t)cfg->stall_every) {
+                stalled = (uint32_t)(cfg->stall_ms * cfg->hz / 1000 + 0.5);
+                due += stalled * period;
+                fa->skipped += stalled;
+                since_stall = 0;
+            }
+            int64_t wake = due + (jitter ? offset(rng) : 0);
+            ts.tv_sec = wake / 1000000000L;
+            ts.tv_nsec = wake % 1000000000L;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+            // the frames of a stall go by at once, the reader sees the counter
+            // jump as if it had been held up itself.  Triple buffered, each
+            // still takes its buffer so the counters keep the chain
+            // mister_scaler_select follows, and the two the buffers hold when
+            // the next one is due get their pixels as well.
+            for (; stalled; stalled--) {
+                uint32_t n = fa->frames;
+                if (cfg->triple) write_frame(fa, n, stalled <= 2);
+                fa->frames = n + 1;
+            }
+            fake_ascal_step(fa);
+        }
+    });
+    return 1;
+}
+
+void fake_ascal_stop(fake_ascal *fa) {
+    if (!fa->running) return;
+    fa->running = false;
+    fa->thread.join();
+}
@@ -0,0 +1,60 @@
+/*
+Fake ASCAL device: a file or memfd laid out like the memory at
+MISTER_SCALER_BASEADDR (header, pixels and, when triple buffered, the two
+other buffers), plus a generator that draws frames and bumps the frame
+counter like the scaler does.  Point shmem at it with shmem_set_source_fd()
+or MISTER_MEM=<path> and every tool runs without a MiSTer.
+*/
+
+#ifndef FAKE_ASCAL_H
+#define FAKE_ASCAL_H
+
+#include <stdint.h>
+
+typedef struct {
+   int    width;
+   int    height;
+   int    format;         // header byte 4
+   int    output_width;   // 0 = same as width
+   int    output_height;  // 0 = same as height
+   int    flags;          // extra bits for header byte 5, with MISTER_SCALER_INTERLACED
+                          // every frame is the next field of a picture 2*height high
+   bool   triple;
+   double hz;
+   int    hold;           // frames each picture is shown, 1 = always moving
+   const unsigned char *image; // RGB24 width*height shown instead of the test picture
+   bool   stamp;          // write the frame number into the top rows, see fake_ascal_read_stamp
+   int    jitter_us;      // every frame comes up to this much early or late
+   int    stall_every;    // every this many frames ...
+   int    stall_ms;       // ... stay quiet this long, then carry on with the frame that is due
+} fake_ascal_config;
+
+// The stamp is two bands of 32 blocks, FAKE_ASCAL_STAMP_ROWS/2 rows each, the
+// frame number in black and white MSB first and below it the complement
+#define FAKE_ASCAL_STAMP_ROWS 16
+
+struct fake_ascal;
+
+void fake_ascal_defaults(fake_ascal_config *cfg);
+// path NULL creates an anonymous memfd
+fake_ascal *fake_ascal_create(const char *path, const fake_ascal_config *cfg);
+void fake_ascal_free(fake_ascal *fa);
+int  fake_ascal_fd(fake_ascal *fa);
+
+// Writes the next frame right away
+void fake_ascal_step(fake_ascal *fa);
+// Runs fake_ascal_step at cfg->hz on a thread until fake_ascal_stop
+int  fake_ascal_start(fake_ascal *fa);
+void fake_ascal_stop(fake_ascal *fa);
+uint32_t fake_ascal_frames(fake_ascal *fa);
+// Frames that went by during stalls instead of on their schedule
+uint32_t fake_ascal_skipped(fake_ascal *fa);
+
+// The test picture of frame n as 0xRRGGBB
+uint32_t fake_ascal_pixel(const fake_ascal_config *cfg, uint32_t n, int x, int y);
+
+// Reads a stamp back from a luma plane (or any grey picture of the frame),
+// returns 0 and the frame number, or -1 when there is none
+int fake_ascal_read_stamp(const unsigned char *luma, int stride, int width, int height, uint32_t *n);
+
+#endif
@@ -3,31 +3,624 @@ Copyright 2019 alanswx
 with help from the MiSTer contributors including Grabulosaure 
 */
 
+#include <stdarg.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <sched.h>
 #include <inttypes.h>
 #include <ctype.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
 
+#include "apng.h"
+#include "crt.h"
 #include "lodepng.h"
+#include "pngtext.h"
+#include "postproc.h"
+#include "resample.h"
 #include "scaler.h"
+#include "trace.h"
 
 const char *version = "$VER:ScreenShot" VDATE;
 
-#define BASEADDR 536870912 
+// lodepng calls this in place of its zlib step, which splits the encode
+// into the filter and compress spans
+struct traced_encode {
+    int filter_span;
+    bool filtered;
+};
 
-unsigned char buffer[2048*3*1024];
+static unsigned traced_zlib(unsigned char **out, size_t *outsize,
+                            const unsigned char *in, size_t insize,
+                            const LodePNGCompressSettings *settings)
+{
+    traced_encode *te = (traced_encode *)settings->custom_context;
+    trace_end(te->filter_span);
+    te->filtered = true;
+
+    int span = trace_begin("compress");
+    unsigned error = lodepng_zlib_compress(out, outsize, in, insize, settings);
+    trace_end(span);
+    return error;
+}
+
+// Ancillary chunks that say where the picture came from and how it relates
+// to what was on screen
+#define PNG_META_TEXTS 16
+typedef struct {
+    unsigned phys_x, phys_y;    // pixel aspect for pHYs, 0 for none
+    int texts;
+    const char *key[PNG_META_TEXTS];
+    char value[PNG_META_TEXTS][64];
+} png_meta;
+
+static void add_text(png_meta *meta, const char *key, const char *fmt, ...)
+{
+    if (meta->texts == PNG_META_TEXTS) return;
+    va_list ap;
+    va_start(ap, fmt);
+    meta->key[meta->texts] = key;
+    vsnprintf(meta->value[meta->texts], sizeof(meta->value[0]), fmt, ap);
+    va_end(ap);
+    meta->texts++;
+}
+
+static unsigned save_png(const char *filename, const unsigned char *image, unsigned w, unsigned h,
+                         const png_meta *meta)
+{
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = LCT_RGB;
+    state.info_raw.bitdepth = 8;
+    if (meta && meta->phys_x) {
+        // unit 0, only the aspect of the pixels
+        state.info_png.phys_defined = 1;
+        state.info_png.phys_x = meta->phys_x;
+        state.info_png.phys_y = meta->phys_y;
+        state.info_png.phys_unit = 0;
+    }
+
+    traced_encode te;
+    te.filtered = false;
+    state.encoder.zlibsettings.custom_zlib = traced_zlib;
+    state.encoder.zlibsettings.custom_context = &te;
+
+    unsigned char *png = NULL;
+    size_t pngsize = 0;
+    int span = trace_begin("encode");
+    te.filter_span = trace_begin("filter");
+    unsigned error = lodepng_encode(&png, &pngsize, image, w, h, &state);
+    if (!te.filtered) trace_end(te.filter_span);
+    trace_end(span);
+    lodepng_state_cleanup(&state);
+
+    // the text goes in before IDAT without encoding again, so
+    // mister_index finds it in the first few hundred bytes
+    if (!error && meta && meta->texts) {
+        span = trace_begin("text");
+        const char *values[PNG_META_TEXTS];
+        for (int i = 0; i < meta->texts; i++) values[i] = meta->value[i];
+        error = pngtext_insert(&png, &pngsize, meta->key, values, meta->texts);
+        trace_end(span);
+    }
+
+    if (!error) {
+        span = trace_begin("write");
+        error = lodepng_save_file(png, pngsize, filename);
+        trace_end(span);
+    }
+    free(png);
+    return error;
+}
+
+// Records frames frames, one every `every` frames of the core, into an APNG
+static unsigned save_clip(mister_scaler *ms, const char *filename, int frames, int every,
+                          unsigned char *image)
+{
+    apng_writer *aw = apng_create(ms->width, ms->height);
+    struct timespec ts;
+
+    int span = trace_begin("capture");
+    for (int i = 0; i < frames; i++) {
+        for (int n = 0; i && n < every; n++) {
+            mister_scaler_wait_frame(ms, 100);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        mister_scaler_read(ms, image);
+        apng_add_frame(aw, image, (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+    }
+    trace_end(span);
+    fprintf(stderr, "%d frames, %u changed, %s\n", frames, apng_frames(aw),
+            apng_paletted(aw) ? "palette" : "RGB");
+
+    unsigned char *png = NULL;
+    size_t pngsize = 0;
+    span = trace_begin("encode");
+    unsigned error = apng_encode(aw, &png, &pngsize);
+    trace_end(span);
+    apng_free(aw);
+
+    if (!error) {
+        span = trace_begin("write");
+        error = lodepng_save_file(png, pngsize, filename);
+        trace_end(span);
+    }
+    free(png);
+    return error;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options] [output name]\n"
+        "  -a, --apng N       record N frames as an animated PNG\n"
+        "  -n, --every N      with --apng, take every Nth frame of the core (1)\n"
+        "  -c, --crop WxH+X+Y save only this rectangle, or auto to cut off a black\n"
+        "                     border\n"
+        "  -i, --deinterlace MODE  for interlaced cores, weave the two fields into\n"
+        "                     one frame or double the lines of one: weave, double\n"
+        "                     or off (off)\n"
+        "  -s, --scale MODE   scale to the displayed size: nearest, area or bilinear\n"
+        "  -S, --size WxH     with --scale, this size instead; a 0 keeps the displayed\n"
+        "                     aspect, e.g. 0x480; area shrinks by at most 60 each way\n"
+        "  -C, --crt SCALE[,SCANLINE[,BLUR]]  upscale by SCALE with scanlines SCANLINE\n"
+        "                     percent darker (40) and BLUR percent of horizontal blur (0)\n"
+        "  -N, --native WxH   when the buffer is flagged as downscaled, repeat its pixels\n"
+        "                     by the whole factor closest to the core's own WxH\n"
+        "  -m, --thumb W      also save a thumbnail W pixels wide, as NAME_thumb.png;\n"
+        "                     the picture may be at most 60 times its size each way\n"
+        "  -x, --text TEXT    draw TEXT at the bottom left with Imlib2, %%N is the core\n"
+        "                     name and the rest goes through strftime\n"
+        "      --font NAME/SIZE  TrueType font for --text (DejaVuSans/10)\n"
+        "      --font-dir DIR     where to look for it\n"
+        "  -D, --daemon       stay running and take a screenshot on every SIGUSR1\n"
+        "      --pidfile FILE with --daemon, write the pid to FILE\n"
+        "  -t, --timings      print how long each stage took\n"
+        "  -T, --trace FILE   write the stages as Chrome trace JSON\n"
+        "The output name goes through strftime as well, %%N is the core name.\n",
+        prog);
+}
+
+// Name of the running core as the MiSTer main binary leaves it in /tmp
+static void core_name(char *name, size_t size)
+{
+    snprintf(name, size, "MiSTer");
+    FILE *f = fopen("/tmp/CORENAME", "r");
+    if (!f) return;
+    if (fgets(name, size, f))
+        name[strcspn(name, "\r\n")] = 0;
+    fclose(f);
+    if (!*name) snprintf(name, size, "MiSTer");
+}
+
+// %N becomes the core name, then strftime for the date and time
+static void expand(char *out, size_t size, const char *fmt)
+{
+    char core[64], pattern[4096];
+    core_name(core, sizeof(core));
+    size_t n = 0;
+    for (const char *p = fmt; *p && n + 1 < sizeof(pattern); p++) {
+        if (p[0] == '%' && p[1] == 'N') {
+            for (const char *c = core; *c && n + 2 < sizeof(pattern); c++) {
+                if (*c == '%') pattern[n++] = '%';
+                pattern[n++] = *c;
+            }
+            p++;
+        } else {
+            pattern[n++] = *p;
+            if (p[0] == '%' && p[1] && n + 1 < sizeof(pattern)) pattern[n++] = *++p;
+        }
+    }
+    pattern[n] = 0;
+
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    if (!strftime(out, size, pattern, &tm))
+        snprintf(out, size, "%s", fmt);
+}
+
+// Everything a screenshot needs, kept across the captures of --daemon
+struct shot {
+    mister_scaler *ms;
+    int clip_frames, every;
+    int scale, scale_w, scale_h;
+    const char *crop;
+    int crop_x, crop_y, crop_w, crop_h;
+    int thumb_w;
+    int native_w, native_h;
+    int crt;
+    mister_crt_opts crt_opts;
+    const char *text;
+    mister_postproc *pp;
+
+    // made for the current header
+    int disp_w, disp_h;
+    int out_w, out_h, thumb_h;
+    int up_x, up_y;     // whole factors a downscaled buffer is repeated by
+    struct timespec when;   // of the last capture
+    mister_resampler *rs, *thumb;
+    mister_crt *crt_up;
+    unsigned char *outputbuf, *thumbbuf, *bgra;
+};
+
+static void shot_release(shot *s)
+{
+    mister_resampler_free(s->rs);
+    mister_resampler_free(s->thumb);
+    mister_crt_free(s->crt_up);
+    free(s->outputbuf);
+    free(s->thumbbuf);
+    free(s->bgra);
+    s->rs = s->thumb = NULL;
+    s->crt_up = NULL;
+    s->outputbuf = s->thumbbuf = s->bgra = NULL;
+}
+
+// n over m to the nearest whole number, at least 1
+static int whole_factor(int n, int m)
+{
+    if (m <= 0) return 1;
+    int f = (n + m / 2) / m;
+    return f > 1 ? f : 1;
+}
+
+// Region, sizes and resamplers for the header as it is now
+static bool shot_setup(shot *s)
+{
+    mister_scaler *ms = s->ms;
+    shot_release(s);
+    if (s->crop && !strcmp(s->crop, "auto"))
+        mister_scaler_auto_crop(ms, MISTER_BORDER_LEVEL);  // all black keeps everything
+    else if (s->crop)
+        mister_scaler_set_roi(ms, s->crop_x, s->crop_y, s->crop_w, s->crop_h);
+
+    // the size the core is shown at, the buffer can be anything from the
+    // core's own resolution to a downscaled output; a crop is shown at its
+    // share of it
+    int disp_w = ms->width, disp_h = ms->height;
+    if (ms->output_width && ms->frame_width)
+        disp_w = (int)((int64_t)ms->output_width * ms->width / ms->frame_width);
+    if (ms->output_height && ms->frame_height)
+        disp_h = (int)((int64_t)ms->output_height * ms->height / ms->frame_height);
+    if (disp_w < 1) disp_w = 1;
+    if (disp_h < 1) disp_h = 1;
+    s->disp_w = disp_w;
+    s->disp_h = disp_h;
 
-void mister_scaler_free(mister_scaler *);
+    s->out_w = ms->width;
+    s->out_h = ms->height;
+    if (s->scale >= 0 && !s->clip_frames) {
+        s->out_w = s->scale_w ? s->scale_w : disp_w;
+        s->out_h = s->scale_h ? s->scale_h : disp_h;
+        if (s->scale_w && !s->scale_h) s->out_h = (s->scale_w * disp_h + disp_w / 2) / disp_w;
+        if (s->scale_h && !s->scale_w) s->out_w = (s->scale_h * disp_w + disp_h / 2) / disp_h;
+        // with post-processing Imlib2 scales
+        if (!s->pp) {
+            s->rs = mister_resampler_create(ms->width, ms->height, s->out_w, s->out_h, s->scale);
+            if (!s->rs) {
+                fprintf(stderr, "unable to scale %dx%d to %dx%d\n", ms->width, ms->height, s->out_w, s->out_h);
+                return false;
+            }
+        }
+    }
+
+    // a downscaled buffer goes back near the core's own size by repeating
+    // every pixel a whole number of times, the flags say which way it shrank
+    s->up_x = s->up_y = 1;
+    if (s->native_w && ms->downscaled && s->scale < 0 && !s->crt && !s->clip_frames) {
+        if (ms->downscaled & MISTER_SCALER_HDOWNSCALED)
+            s->up_x = whole_factor(s->native_w, ms->frame_width);
+        if (ms->downscaled & MISTER_SCALER_VDOWNSCALED)
+            s->up_y = whole_factor(s->native_h, ms->frame_height);
+        s->out_w = ms->width * s->up_x;
+        s->out_h = ms->height * s->up_y;
+        if ((s->up_x > 1 || s->up_y > 1) && !s->pp) {
+            s->rs = mister_resampler_create(ms->width, ms->height, s->out_w, s->out_h, MISTER_SCALE_NEAREST);
+            if (!s->rs) {
+                fprintf(stderr, "unable to scale %dx%d to %dx%d\n", ms->width, ms->height, s->out_w, s->out_h);
+                return false;
+            }
+        }
+    }
+
+    if (s->crt && !s->clip_frames) {
+        s->crt_up = mister_crt_create(ms->width, ms->height, &s->crt_opts);
+        if (!s->crt_up) {
+            fprintf(stderr, "unable to upscale %dx%d by %d\n", ms->width, ms->height, s->crt_opts.scale);
+            return false;
+        }
+        s->out_w = ms->width * s->crt_opts.scale;
+        s->out_h = ms->height * s->crt_opts.scale;
+    }
+
+    // at the displayed aspect, made from the rows of the screenshot as they
+    // are read, or from the scaled picture when there is one
+    if (s->thumb_w && !s->clip_frames) {
+        s->thumb_h = (int)(((int64_t)s->thumb_w * disp_h + disp_w / 2) / disp_w);
+        if (s->thumb_h < 1) s->thumb_h = 1;
+        s->thumb = mister_resampler_create(s->out_w, s->out_h, s->thumb_w, s->thumb_h, MISTER_SCALE_AREA);
+        s->thumbbuf = (unsigned char *)malloc((size_t)s->thumb_w*s->thumb_h*3);
+        if (!s->thumb || !s->thumbbuf) {
+            fprintf(stderr, "unable to make a %dx%d thumbnail of %dx%d, at most 60 times smaller\n",
+                    s->thumb_w, s->thumb_h, s->out_w, s->out_h);
+            mister_resampler_free(s->thumb);
+            free(s->thumbbuf);
+            s->thumb = NULL;
+            s->thumbbuf = NULL;
+        }
+    }
+
+    s->outputbuf = (unsigned char*)calloc((size_t)s->out_w*s->out_h*3,1);
+    if (s->pp)
+        s->bgra = (unsigned char *)malloc((size_t)ms->width*ms->height*4);
+    return s->outputbuf && (!s->pp || s->bgra);
+}
+
+static unsigned gcd(unsigned a, unsigned b)
+{
+    while (b) {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// The pixel aspect that shows the picture at the displayed size, and where
+// the buffer was downscaled, by how much and what was done about it
+static void shot_meta(const shot *s, png_meta *meta)
+{
+    const mister_scaler *ms = s->ms;
+    memset(meta, 0, sizeof(*meta));
+    // a pixel is disp_w/out_w wide and disp_h/out_h high, pHYs counts
+    // pixels per unit
+    unsigned px = (unsigned)s->out_w * s->disp_h, py = (unsigned)s->out_h * s->disp_w;
+    unsigned g = gcd(px, py);
+    if (px != py && g) {
+        meta->phys_x = px / g;
+        meta->phys_y = py / g;
+    }
+
+    char core[64], when[64];
+    core_name(core, sizeof(core));
+    struct tm tm;
+    localtime_r(&s->when.tv_sec, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+    size_t len = strlen(when);
+    snprintf(when + len, sizeof(when) - len, ".%03d", (int)(s->when.tv_nsec / 1000000));
+    len = strlen(when);
+    strftime(when + len, sizeof(when) - len, "%z", &tm);
+
+    add_text(meta, "Software", "%s", version + 5);
+    add_text(meta, "Core", "%s", core);
+    add_text(meta, "Capture time", "%s", when);
+    add_text(meta, "Native size", "%dx%d", ms->frame_width, ms->frame_height);
+    add_text(meta, "Output size", "%dx%d", ms->output_width, ms->output_height);
+    add_text(meta, "Display size", "%dx%d", s->disp_w, s->disp_h);
+    if (ms->width != ms->frame_width || ms->height != ms->frame_height)
+        add_text(meta, "Region", "%dx%d+%d+%d", ms->width, ms->height, ms->crop_x, ms->crop_y);
+    add_text(meta, "Pixel format", "%s (0x%02x)", ms->pixfmt.name, ms->format);
+    add_text(meta, "Frame counter", "%d", ms->counter);
+    add_text(meta, "Tear retries", "%d", ms->tear_retries);
+    if (ms->field >= 0)
+        add_text(meta, "Interlaced", "%s", ms->deinterlace == MISTER_DEINTERLACE_WEAVE ? "weave" : "double");
+    if (ms->downscaled) {
+        bool h = ms->downscaled & MISTER_SCALER_HDOWNSCALED, v = ms->downscaled & MISTER_SCALER_VDOWNSCALED;
+        add_text(meta, "Downscaled", "%s", h && v ? "both" : h ? "horizontal" : "vertical");
+        if (s->up_x > 1 || s->up_y > 1)
+            add_text(meta, "Upsampled", "%dx%d", s->up_x, s->up_y);
+    }
+}
+
+static unsigned shot_take(shot *s, const char *filename)
+{
+    mister_scaler *ms = s->ms;
+    unsigned error;
+    if (s->clip_frames) {
+        error = save_clip(ms, filename, s->clip_frames, s->every, s->outputbuf);
+    } else {
+        const unsigned char *image = s->outputbuf;
+        clock_gettime(CLOCK_REALTIME, &s->when);
+        if (s->pp) {
+            // read as BGRA, which Imlib2 works on in place
+            mister_scaler_read_32(ms, s->bgra);
+            char text[1024];
+            mister_postproc_opts opts;
+            memset(&opts, 0, sizeof(opts));
+            // the upscale comes after the text
+            opts.scale_w = s->crt_up ? ms->width : s->out_w;
+            opts.scale_h = s->crt_up ? ms->height : s->out_h;
+            opts.smooth = s->scale > MISTER_SCALE_NEAREST;
+            if (s->text) {
+                expand(text, sizeof(text), s->text);
+                opts.text = text;
+            }
+            int w, h;
+            image = mister_postproc_run(s->pp, s->bgra, ms->width, ms->height, &opts, &w, &h);
+            if (!image) {
+                fprintf(stderr, "post-processing failed\n");
+                return 1;
+            }
+            if (s->crt_up) {
+                int span = trace_begin("crt");
+                mister_crt_rgb24(s->crt_up, image, s->outputbuf, s->out_w*3);
+                trace_end(span);
+                image = s->outputbuf;
+            }
+        } else if (s->crt_up) {
+            mister_scaler_read_crt(ms, s->crt_up, s->outputbuf, s->out_w*3);
+        } else if (s->rs) {
+            mister_scaler_read_scaled(ms, s->rs, s->outputbuf);
+        } else if (s->thumb) {
+            mister_scaler_read_thumb(ms, s->outputbuf, s->thumb, s->thumbbuf);
+        } else {
+            mister_scaler_read(ms,s->outputbuf);
+        }
+        // from the finished picture unless the read made it on the way
+        if (s->thumb && (s->pp || s->crt_up || s->rs)) {
+            int span = trace_begin("thumb");
+            mister_resample_rgb24(s->thumb, image, s->thumbbuf);
+            trace_end(span);
+        }
+        png_meta meta;
+        shot_meta(s, &meta);
+        error = save_png(filename, image, s->out_w, s->out_h, &meta);
+    }
+    if(error) {
+        fprintf(stderr,"error %u: %s\n", error, lodepng_error_text(error));
+    } else {
+        printf("saved: /tmp/.SAM_tmp/screenshots/%s\n", filename);
+    }
+    if (!error && s->thumb) {
+        // next to the screenshot, NAME.png gets NAME_thumb.png
+        char thumbname[4096 + 16];
+        size_t len = strlen(filename);
+        if (len > 4 && !strcasecmp(filename + len - 4, ".png")) len -= 4;
+        snprintf(thumbname, sizeof(thumbname), "%.*s_thumb.png", (int)len, filename);
+        error = save_png(thumbname, s->thumbbuf, s->thumb_w, s->thumb_h, NULL);
+        if (error)
+            fprintf(stderr,"error %u: %s\n", error, lodepng_error_text(error));
+        else
+            printf("saved: /tmp/.SAM_tmp/screenshots/%s\n", thumbname);
+    }
+    fflush(stdout);
+    return error;
+}
+
+static void print_timings(const shot *s)
+{
+    mister_scaler *ms = s->ms;
+    fprintf(stderr, "\n%dx%d %s, %d tear retries\n", ms->width, ms->height,
+            ms->pixfmt.name, ms->tear_retries);
+    if (s->crop)
+        fprintf(stderr, "cropped at %d,%d of %dx%d\n", ms->crop_x, ms->crop_y,
+                ms->frame_width, ms->frame_height);
+    if (ms->downscaled)
+        fprintf(stderr, "downscaled %s, repeated %dx%d\n",
+                ms->downscaled == (MISTER_SCALER_HDOWNSCALED | MISTER_SCALER_VDOWNSCALED) ? "both ways" :
+                ms->downscaled & MISTER_SCALER_HDOWNSCALED ? "horizontally" : "vertically", s->up_x, s->up_y);
+    if (s->crt_up)
+        fprintf(stderr, "upscaled to %dx%d, scanlines %d%%, blur %d%%\n", s->out_w, s->out_h,
+                s->crt_opts.scanline, s->crt_opts.blur);
+    if (s->scale >= 0 && !s->clip_frames)
+        fprintf(stderr, "scaled to %dx%d, %s\n", s->out_w, s->out_h,
+                s->pp ? "Imlib2" : mister_scale_name(s->scale));
+    trace_print(stderr);
+}
+
+enum { OPT_FONT = 256, OPT_FONT_DIR, OPT_PIDFILE };
 
 int main(int argc, char *argv[])
 {
+    int total = trace_begin("screenshot");
+
+    bool timings = false;
+    const char *trace_file = NULL;
+    int deinterlace = MISTER_DEINTERLACE_OFF;
+    bool daemon_mode = false;
+    const char *pidfile = NULL;
+    const char *font = "DejaVuSans/10";
+    const char *font_dir = NULL;
+    shot s;
+    memset(&s, 0, sizeof(s));
+    s.every = 1;
+    s.scale = -1;
+    static const struct option long_opts[] = {
+        { "thumb",   required_argument, NULL, 'm' },
+        { "native",  required_argument, NULL, 'N' },
+        { "crt",     required_argument, NULL, 'C' },
+        { "crop",    required_argument, NULL, 'c' },
+        { "apng",    required_argument, NULL, 'a' },
+        { "every",   required_argument, NULL, 'n' },
+        { "deinterlace", required_argument, NULL, 'i' },
+        { "scale",   required_argument, NULL, 's' },
+        { "size",    required_argument, NULL, 'S' },
+        { "text",    required_argument, NULL, 'x' },
+        { "font",    required_argument, NULL, OPT_FONT },
+        { "font-dir", required_argument, NULL, OPT_FONT_DIR },
+        { "daemon",  no_argument,       NULL, 'D' },
+        { "pidfile", required_argument, NULL, OPT_PIDFILE },
+        { "timings", no_argument,       NULL, 't' },
+        { "trace",   required_argument, NULL, 'T' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "a:c:C:m:N:n:i:s:S:x:DtT:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'a': s.clip_frames = atoi(optarg); break;
+            case 'c':
+                s.crop = optarg;
+                if (strcmp(s.crop, "auto") && mister_roi_parse(s.crop, &s.crop_x, &s.crop_y, &s.crop_w, &s.crop_h)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'C':
+                if (mister_crt_parse(optarg, &s.crt_opts)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                s.crt = 1;
+                break;
+            case 'm': s.thumb_w = atoi(optarg); break;
+            case 'N':
+                if (sscanf(optarg, "%dx%d", &s.native_w, &s.native_h) != 2 || s.native_w < 1 || s.native_h < 1) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'n': s.every = atoi(optarg); break;
+            case 'i':
+                deinterlace = mister_deinterlace_parse(optarg);
+                if (deinterlace < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 's':
+                s.scale = mister_scale_parse(optarg);
+                if (s.scale < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'S':
+                if (sscanf(optarg, "%dx%d", &s.scale_w, &s.scale_h) != 2 || s.scale_w < 0 || s.scale_h < 0 ||
+                    (!s.scale_w && !s.scale_h)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'x': s.text = optarg; break;
+            case OPT_FONT: font = optarg; break;
+            case OPT_FONT_DIR: font_dir = optarg; break;
+            case 'D': daemon_mode = true; break;
+            case OPT_PIDFILE: pidfile = optarg; break;
+            case 't': timings = true; break;
+            case 'T': trace_file = optarg; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    // the upscale is the output size, nothing else may change it
+    if (argc - optind > 1 || s.clip_frames < 0 || s.every < 1 || s.thumb_w < 0 ||
+        (s.crt && (s.scale >= 0 || s.clip_frames))) {
+        usage(argv[0]);
+        return 1;
+    }
+
     // Always write into RAM tmp folder
     if (mkdir("/tmp/.SAM_tmp/screenshots", 0777) != 0 && errno != EEXIST) {
         perror("mkdir");
@@ -38,35 +631,86 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    char filename[4096];
-    strcpy(filename,"MiSTer_screenshot.png");
-    if (argc > 1) 
+    // a daemon needs a new name for every capture
+    const char *pattern = s.clip_frames ? "MiSTer_clip.png" :
+                          daemon_mode ? "%N_%Y%m%d-%H%M%S.png" : "MiSTer_screenshot.png";
+    if (optind < argc)
     {
-        fprintf(stderr,"output name: %s\n", argv[1]);
-        strcpy(filename,argv[1]);
+        fprintf(stderr,"output name: %s\n", argv[optind]);
+        pattern = argv[optind];
     }
+    char filename[4096];
 
-    mister_scaler *ms = mister_scaler_init();
-    if (ms == NULL)
+    if (s.text) {
+        s.pp = mister_postproc_create(font_dir, font);
+        if (!s.pp) return 1;
+    }
+
+    s.ms = mister_scaler_init();
+    if (s.ms == NULL)
     {
         fprintf(stderr,"some problem with the mister scaler, maybe this core doesn't support it\n");
         exit(1);
     } 
+    if (deinterlace)
+        mister_scaler_set_deinterlace(s.ms, deinterlace);
     fprintf(stderr,"\nScreenshot code by alanswx\n\n");
     fprintf(stderr,"Version %s\n\n", version + 5);
-   
-    unsigned char *outputbuf = (unsigned char*)calloc(ms->width*ms->height*3,1);
-    mister_scaler_read(ms,outputbuf);
 
-    unsigned error = lodepng_encode24_file(filename, outputbuf, ms->width, ms->height);
-    if(error) {
-        fprintf(stderr,"error %u: %s\n", error, lodepng_error_text(error));
+    unsigned error = 0;
+    if (!shot_setup(&s)) {
+        error = 1;
+    } else if (!daemon_mode) {
+        expand(filename, sizeof(filename), pattern);
+        error = shot_take(&s, filename);
+        trace_end(total);
+        if (timings) print_timings(&s);
+        if (trace_file && !trace_write_chrome(trace_file)) {
+            fprintf(stderr, "unable to write %s\n", trace_file);
+        }
     } else {
-        printf("saved: /tmp/.SAM_tmp/screenshots/%s\n", filename);
+        // the mapping, resamplers, font and buffers stay, e.g. for
+        // mister_peeper --pidfile to trigger captures
+        trace_end(total);
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGUSR1);
+        // the peeper sends it when a rule clears, nothing to do then
+        sigaddset(&set, SIGUSR2);
+        sigaddset(&set, SIGTERM);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGHUP);
+        sigprocmask(SIG_BLOCK, &set, NULL);
+        if (pidfile) {
+            FILE *f = fopen(pidfile, "w");
+            if (f) {
+                fprintf(f, "%d\n", (int)getpid());
+                fclose(f);
+            } else {
+                perror(pidfile);
+            }
+        }
+        fprintf(stderr, "waiting for SIGUSR1 on pid %d\n", (int)getpid());
+        int sig;
+        while (!sigwait(&set, &sig) && (sig == SIGUSR1 || sig == SIGUSR2)) {
+            if (sig == SIGUSR2)
+                continue;
+            trace_reset();
+            total = trace_begin("screenshot");
+            if (mister_scaler_refresh(s.ms) && !shot_setup(&s)) {
+                trace_end(total);
+                continue;
+            }
+            expand(filename, sizeof(filename), pattern);
+            shot_take(&s, filename);
+            trace_end(total);
+            if (timings) print_timings(&s);
+        }
+        if (pidfile) unlink(pidfile);
     }
 
-    // No scaled image anymore
-    mister_scaler_free(ms);
-    free(outputbuf);
-    return 0;
+    shot_release(&s);
+    mister_postproc_free(s.pp);
+    mister_scaler_free(s.ms);
+    return error ? 1 : 0;
 }
@@ -0,0 +1,396 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "crt.h"
+#include "fake_ascal.h"
+#include "lodepng.h"
+#include "resample.h"
+#include "scaler.h"
+#include "shmem.h"
+
+#ifdef HAVE_IMLIB2
+#include <Imlib2.h>
+#endif
+
+// Times every stage of a screenshot against a fake ASCAL buffer and prints
+// one JSON object per stage and case, so runs can be diffed across versions.
+
+const char *version = "$VER:MisterBench" VDATE;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static const char *default_sizes[] = {
+    "256x224", "320x240", "640x480", "1280x720", "1920x1080"
+};
+static const char *default_formats[] = {
+    "PAL8", "RGB565", "RGB1555", "RGB888", "ARGB8888",
+    "BGR565", "BGR1555", "BGR888", "ABGR8888"
+};
+
+struct bench_result {
+    std::vector<double> us;
+    double bytes;   // processed per iteration
+};
+
+static FILE *out = stdout;
+// target of the scale stages
+static int scale_w = 1280, scale_h = 960;
+
+static double percentile(std::vector<double> &v, double p) {
+    size_t i = (size_t)(p / 100.0 * (v.size() - 1) + 0.5);
+    return v[std::min(i, v.size() - 1)];
+}
+
+static long max_rss_kb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+static void report(const char *size, const char *format, const char *stage,
+                   bench_result &r) {
+    if (r.us.empty()) return;
+    std::sort(r.us.begin(), r.us.end());
+    double sum = 0;
+    for (double t : r.us) sum += t;
+    double mean = sum / r.us.size();
+
+    std::fprintf(out,
+        "{\"version\":\"%s\",\"size\":\"%s\",\"format\":\"%s\",\"stage\":\"%s\","
+        "\"iterations\":%zu,\"bytes\":%.0f,\"mbps\":%.2f,\"mean_us\":%.1f,"
+        "\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,"
+        "\"max_rss_kb\":%ld}\n",
+        version + 5, size, format, stage, r.us.size(), r.bytes,
+        mean > 0 ? r.bytes / mean : 0.0, mean,
+        percentile(r.us, 50), percentile(r.us, 90), percentile(r.us, 99),
+        r.us.back(), max_rss_kb());
+    std::fflush(out);
+}
+
+template <typename F>
+static bench_result measure(int iterations, double bytes, F fn) {
+    bench_result r;
+    r.bytes = bytes;
+    r.us.reserve(iterations);
+    fn(); // warm up caches and page tables
+    for (int i = 0; i < iterations; i++) {
+        auto t0 = bench_clock::now();
+        fn();
+        auto t1 = bench_clock::now();
+        r.us.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+    }
+    return r;
+}
+
+// custom_zlib hook: keeps the filtered scanlines lodepng hands to zlib and
+// skips compression, so the encode time without deflate is what remains.
+struct filter_capture {
+    std::vector<unsigned char> data;
+};
+
+static unsigned capture_zlib(unsigned char **outbuf, size_t *outsize,
+                             const unsigned char *in, size_t insize,
+                             const LodePNGCompressSettings *settings) {
+    filter_capture *fc = (filter_capture *)settings->custom_context;
+    fc->data.assign(in, in + insize);
+    *outbuf = (unsigned char *)std::malloc(1);
+    (*outbuf)[0] = 0;
+    *outsize = 1;
+    return 0;
+}
+
+static void bench_encode(const char *size, const unsigned char *rgb, int w, int h,
+                         int iterations, const char *dir) {
+    filter_capture fc;
+
+    // filter: everything lodepng does except deflate
+    bench_result r = measure(iterations, (double)w * h * 3, [&]() {
+        LodePNGState state;
+        lodepng_state_init(&state);
+        state.info_raw.colortype = LCT_RGB;
+        state.encoder.zlibsettings.custom_zlib = capture_zlib;
+        state.encoder.zlibsettings.custom_context = &fc;
+        unsigned char *png = nullptr;
+        size_t pngsize = 0;
+        lodepng_encode(&png, &pngsize, rgb, w, h, &state);
+        lodepng_state_cleanup(&state);
+        std::free(png);
+    });
+    report(size, "RGB24", "filter", r);
+
+    LodePNGCompressSettings zs;
+    lodepng_compress_settings_init(&zs);
+    r = measure(iterations, (double)fc.data.size(), [&]() {
+        unsigned char *z = nullptr;
+        size_t zsize = 0;
+        lodepng_zlib_compress(&z, &zsize, fc.data.data(), fc.data.size(), &zs);
+        std::free(z);
+    });
+    report(size, "RGB24", "deflate", r);
+
+    unsigned char *png = nullptr;
+    size_t pngsize = 0;
+    lodepng_encode24(&png, &pngsize, rgb, w, h);
+    std::string path = std::string(dir) + "/mister_bench.png";
+    r = measure(iterations, (double)pngsize, [&]() {
+        lodepng_save_file(png, pngsize, path.c_str());
+    });
+    report(size, "RGB24", "write", r);
+    unlink(path.c_str());
+    std::free(png);
+}
+
+static bool bench_case(const char *size, int w, int h, const char *fmtname, int format,
+                       const unsigned char *image, int iterations, std::vector<unsigned char> &rgb) {
+    fake_ascal_config cfg;
+    fake_ascal_defaults(&cfg);
+    cfg.width = w;
+    cfg.height = h;
+    cfg.format = format;
+    cfg.image = image;
+
+    fake_ascal *fa = fake_ascal_create(nullptr, &cfg);
+    if (!fa) return false;
+    shmem_set_source_fd(dup(fake_ascal_fd(fa)), MISTER_SCALER_BASEADDR);
+
+    mister_scaler *ms = mister_scaler_init();
+    if (!ms) {
+        fake_ascal_free(fa);
+        return false;
+    }
+
+    const mister_pixfmt *pf = &ms->pixfmt;
+    int rowbytes = w * pf->bpp;
+    std::vector<unsigned char> raw(rowbytes * h);
+    std::vector<unsigned char> y(w * h), u(w * h), v(w * h);
+    rgb.resize(w * h * 3);
+    const unsigned char *pixels = mister_scaler_pixels(ms);
+
+    bench_result r = measure(iterations, (double)rowbytes * h, [&]() {
+        for (int row = 0; row < h; row++)
+            std::memcpy(&raw[row * rowbytes], pixels + row * ms->line, rowbytes);
+    });
+    report(size, fmtname, "copy", r);
+
+    r = measure(iterations, (double)rowbytes * h, [&]() {
+        for (int row = 0; row < h; row++)
+            mister_row_rgb24(&raw[row * rowbytes], &rgb[row * w * 3], w, pf);
+    });
+    report(size, fmtname, "convert", r);
+
+    r = measure(iterations, (double)rowbytes * h, [&]() {
+        mister_scaler_read(ms, rgb.data());
+    });
+    report(size, fmtname, "read_rgb24", r);
+
+    r = measure(iterations, (double)rowbytes * h, [&]() {
+        mister_scaler_read_yuv(ms, w, y.data(), w, u.data(), w, v.data());
+    });
+    report(size, fmtname, "yuv", r);
+
+    r = measure(iterations, (double)rowbytes * h, [&]() {
+        mister_scaler_read_i420(ms, w, y.data(), (w + 1) / 2, u.data(), (w + 1) / 2, v.data());
+    });
+    report(size, fmtname, "i420", r);
+
+    // what the recorder does with a frame: one raw read, hashed and then
+    // converted from the copy
+    uint64_t hash;
+    r = measure(iterations, (double)rowbytes * h, [&]() {
+        mister_scaler_read_raw(ms, raw.data());
+        hash = mister_frame_hash(raw.data(), w, h, pf);
+    });
+    report(size, fmtname, "hash", r);
+
+    mister_scaler_set_frame(ms, raw.data());
+    r = measure(iterations, (double)rowbytes * h, [&]() {
+        mister_scaler_read_i420(ms, w, y.data(), (w + 1) / 2, u.data(), (w + 1) / 2, v.data());
+    });
+    mister_scaler_set_frame(ms, nullptr);
+    report(size, fmtname, "i420_copy", r);
+
+    // a 160 pixel wide thumbnail on top of the RGB read
+    int thumb_h = (160 * h + w / 2) / w;
+    std::vector<unsigned char> small((size_t)160 * thumb_h * 3);
+    mister_resampler *thumb = mister_resampler_create(w, h, 160, thumb_h ? thumb_h : 1, MISTER_SCALE_AREA);
+    if (thumb) {
+        r = measure(iterations, (double)rowbytes * h, [&]() {
+            mister_scaler_read_thumb(ms, rgb.data(), thumb, small.data());
+        });
+        report(size, fmtname, "read_thumb", r);
+        mister_resampler_free(thumb);
+    }
+
+    // the middle quarter, reads only touch its rows and columns; into its
+    // own buffer, rgb keeps the full frame for the encode stages
+    std::vector<unsigned char> roi((size_t)(w / 2) * (h / 2) * 3);
+    mister_scaler_set_roi(ms, w / 4, h / 4, w / 2, h / 2);
+    r = measure(iterations, (double)(w / 2) * pf->bpp * (h / 2), [&]() {
+        mister_scaler_read(ms, roi.data());
+    });
+    report(size, fmtname, "roi_rgb24", r);
+    mister_scaler_set_roi(ms, 0, 0, 0, 0);
+
+    // scaling fused with the read, against Imlib2 on a 32 bit read
+    std::vector<unsigned char> scaled((size_t)scale_w * scale_h * 3);
+    static const char *scale_stages[] = { "scale_nearest", "scale_area", "scale_bilinear" };
+    for (int mode = 0; mode < 3; mode++) {
+        mister_resampler *rs = mister_resampler_create(w, h, scale_w, scale_h, mode);
+        if (!rs) continue;
+        r = measure(iterations, (double)rowbytes * h, [&]() {
+            mister_scaler_read_scaled(ms, rs, scaled.data());
+        });
+        report(size, fmtname, scale_stages[mode], r);
+        mister_resampler_free(rs);
+    }
+
+    // 2x with scanlines and blur, alone and as a 4:2:0 recording frame
+    mister_crt_opts crt_opts = { 2, 40, 30 };
+    mister_crt *crt = mister_crt_create(w, h, &crt_opts);
+    if (crt) {
+        std::vector<unsigned char> big((size_t)w * 2 * h * 2 * 3);
+        std::vector<unsigned char> by((size_t)w * 2 * h * 2), bu((size_t)w * h), bv((size_t)w * h);
+        r = measure(iterations, (double)rowbytes * h, [&]() {
+            mister_scaler_read_crt(ms, crt, big.data(), w * 2 * 3);
+        });
+        report(size, fmtname, "crt_2x", r);
+        r = measure(iterations, (double)rowbytes * h, [&]() {
+            mister_scaler_read_crt(ms, crt, big.data(), w * 2 * 3);
+            mister_rgb24_i420(big.data(), w * 2, h * 2, w * 2, by.data(), w, bu.data(), w, bv.data());
+        });
+        report(size, fmtname, "crt_2x_i420", r);
+        mister_crt_free(crt);
+    }
+#ifdef HAVE_IMLIB2
+    std::vector<unsigned char> argb((size_t)w * h * 4);
+    for (int smooth = 0; smooth < 2; smooth++) {
+        r = measure(iterations, (double)rowbytes * h, [&]() {
+            mister_scaler_read_32(ms, argb.data());
+            Imlib_Image src = imlib_create_image_using_data(w, h, (DATA32 *)argb.data());
+            imlib_context_set_image(src);
+            imlib_context_set_anti_alias(smooth);
+            Imlib_Image dst = imlib_create_cropped_scaled_image(0, 0, w, h, scale_w, scale_h);
+            imlib_free_image();
+            imlib_context_set_image(dst);
+            imlib_free_image();
+        });
+        report(size, fmtname, smooth ? "imlib2_smooth" : "imlib2_nearest", r);
+    }
+#endif
+
+    mister_scaler_free(ms);
+    fake_ascal_free(fa);
+    return true;
+}
+
+static void usage(const char *prog) {
+    std::fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -s WxH[,WxH...]   frame sizes (256x224,320x240,640x480,1280x720,1920x1080)\n"
+        "  -f FMT[,FMT...]   pixel formats (all)\n"
+        "  -i FILE.png       use a recorded frame instead of the test picture\n"
+        "  -n N              iterations per stage (20)\n"
+        "  -S WxH            target of the scale stages (1280x960)\n"
+        "  -d DIR            directory for the write stage (/tmp)\n"
+        "  -o FILE           write the JSON lines to FILE instead of stdout\n",
+        prog);
+}
+
+static std::vector<std::string> split(const char *arg) {
+    std::vector<std::string> v;
+    std::string s(arg);
+    size_t pos = 0, comma;
+    while ((comma = s.find(',', pos)) != std::string::npos) {
+        v.push_back(s.substr(pos, comma - pos));
+        pos = comma + 1;
+    }
+    v.push_back(s.substr(pos));
+    return v;
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> sizes(default_sizes, default_sizes + 5);
+    std::vector<std::string> formats(default_formats, default_formats + 9);
+    const char *image_file = nullptr;
+    const char *dir = "/tmp";
+    int iterations = 20;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:f:i:n:S:d:o:h")) != -1) {
+        switch (opt) {
+            case 's': sizes = split(optarg); break;
+            case 'f': formats = split(optarg); break;
+            case 'i': image_file = optarg; break;
+            case 'n': iterations = std::atoi(optarg); break;
+            case 'S':
+                if (std::sscanf(optarg, "%dx%d", &scale_w, &scale_h) != 2 || scale_w <= 0 || scale_h <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'd': dir = optarg; break;
+            case 'o':
+                out = std::fopen(optarg, "w");
+                if (!out) {
+                    std::fprintf(stderr, "unable to open %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (iterations < 1 || optind != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    unsigned char *image = nullptr;
+    if (image_file) {
+        unsigned w, h;
+        unsigned error = lodepng_decode24_file(&image, &w, &h, image_file);
+        if (error) {
+            std::fprintf(stderr, "%s: %s\n", image_file, lodepng_error_text(error));
+            return 1;
+        }
+        sizes.assign(1, std::to_string(w) + "x" + std::to_string(h));
+    }
+
+    std::vector<unsigned char> rgb;
+    for (const std::string &size : sizes) {
+        int w, h;
+        if (std::sscanf(size.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+            std::fprintf(stderr, "bad size %s\n", size.c_str());
+            return 1;
+        }
+
+        bool have_rgb = false;
+        for (const std::string &name : formats) {
+            int format = mister_pixfmt_parse(name.c_str());
+            if (format < 0) {
+                std::fprintf(stderr, "unknown format %s\n", name.c_str());
+                return 1;
+            }
+            // formats that don't fit the buffer at this size are skipped
+            if (bench_case(size.c_str(), w, h, mister_pixfmt_decode(format).name,
+                           format, image, iterations, rgb))
+                have_rgb = true;
+        }
+        // the encoder only ever sees RGB24, run it once per size
+        if (have_rgb) bench_encode(size.c_str(), rgb.data(), w, h, iterations, dir);
+    }
+
+    std::free(image);
+    if (out != stdout) std::fclose(out);
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "fake_ascal.h"
+#include "scaler.h"
+
+// Serves a fake ASCAL buffer from a file, e.g.
+//   mister_fake -s 256x224 -f rgb565 /dev/shm/ascal &
+//   MISTER_MEM=/dev/shm/ascal screensht
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int) {
+    running = 0;
+}
+
+static void usage(const char *prog) {
+    std::fprintf(stderr,
+        "Usage: %s [options] <file>\n"
+        "  -s WxH      frame size (320x240)\n"
+        "  -o WxH      output size in the header (same as -s)\n"
+        "  -f FORMAT   rgb888, bgr565, rgb1555, argb8888, pal8, ... (rgb888)\n"
+        "  -r HZ       frame rate (60)\n"
+        "  -H N        hold every picture for N frames (1)\n"
+        "  -d h|v|hv   flag the buffer as downscaled horizontally and/or vertically\n"
+        "  -i          interlaced, every frame is the next field of a picture\n"
+        "              twice as high, with the field bit flipping\n"
+        "  -t          triple buffered\n"
+        "  -S          stamp the frame number into the top rows, for mister_verify\n"
+        "  -j US       move every frame up to US microseconds off the schedule\n"
+        "  -p N:MS     every N frames stall for MS milliseconds, the counter\n"
+        "              then jumps by the frames that went by\n"
+        "  -n N        stop after N frames\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    fake_ascal_config cfg;
+    fake_ascal_defaults(&cfg);
+    long limit = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:o:f:r:H:d:itSj:p:n:h")) != -1) {
+        switch (opt) {
+            case 's':
+                if (std::sscanf(optarg, "%dx%d", &cfg.width, &cfg.height) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                if (std::sscanf(optarg, "%dx%d", &cfg.output_width, &cfg.output_height) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'f':
+                cfg.format = mister_pixfmt_parse(optarg);
+                if (cfg.format < 0) {
+                    std::fprintf(stderr, "unknown format %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r': cfg.hz = std::atof(optarg); break;
+            case 'H': cfg.hold = std::atoi(optarg); break;
+            case 'd':
+                if (std::strchr(optarg, 'h')) cfg.flags |= MISTER_SCALER_HDOWNSCALED;
+                if (std::strchr(optarg, 'v')) cfg.flags |= MISTER_SCALER_VDOWNSCALED;
+                break;
+            case 'i': cfg.flags |= MISTER_SCALER_INTERLACED; break;
+            case 't': cfg.triple = true; break;
+            case 'S': cfg.stamp = true; break;
+            case 'j': cfg.jitter_us = std::atoi(optarg); break;
+            case 'p':
+                if (std::sscanf(optarg, "%d:%d", &cfg.stall_every, &cfg.stall_ms) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'n': limit = std::atol(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || cfg.hz <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    fake_ascal *fa = fake_ascal_create(argv[optind], &cfg);
+    if (!fa) return 1;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    std::fprintf(stderr, "%s: %dx%d %s at %.2f Hz%s\n", argv[optind],
+                 cfg.width, cfg.height, mister_pixfmt_decode(cfg.format).name,
+                 cfg.hz, cfg.triple ? ", triple buffered" : "");
+    fake_ascal_start(fa);
+    while (running && (!limit || fake_ascal_frames(fa) < (uint32_t)limit))
+        usleep(10000);
+
+    std::fprintf(stderr, "%u frames, %u skipped in stalls\n", fake_ascal_frames(fa), fake_ascal_skipped(fa));
+    fake_ascal_free(fa);
+    return 0;
+}
@@ -0,0 +1,335 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pngtext.h"
+
+// Indexes screenshots by their size and text chunks, one JSON object per
+// file, from the head of each file only: screensht puts its text before the
+// pixels, so nothing is inflated and most files cost one small read.  With
+// -d the index of a directory is kept on disk keyed by mtime and size, and a
+// run only reads the files that are new or changed since the last one.
+
+const char *version = "$VER:MisterIndex" VDATE;
+
+// a head this big holds the signature, IHDR, pHYs and the text of a screenshot
+#define HEAD_BYTES 1024
+// files that need more than this before their first IDAT are skipped
+#define MAX_HEAD (1 << 20)
+// kept in the directory it indexes, skipped by the walk like every dot file
+#define INDEX_NAME ".mister_index"
+
+typedef std::chrono::steady_clock index_clock;
+
+struct entry {
+    std::vector<std::pair<std::string, std::string>> text;
+};
+
+// One line of the index for every file, with what it was made from
+struct indexed {
+    long long mtime_ns;
+    long long size;
+    std::string line;
+    bool seen;
+};
+
+struct index_stats {
+    int files, read, failed, removed;
+};
+
+static void on_text(void *ctx, const char *key, const char *value) {
+    entry *e = (entry *)ctx;
+    e->text.push_back(std::make_pair(key, value));
+}
+
+static void json_string(std::string &out, const char *s) {
+    out += '"';
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char esc[8];
+            std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// The string json_string wrote at s, p is left after its closing quote
+static bool json_unstring(const char *s, const char **p, std::string &out) {
+    if (*s++ != '"') return false;
+    out.clear();
+    for (; *s && *s != '"'; s++) {
+        if (*s != '\\') {
+            out += *s;
+        } else if (s[1] == 'u') {
+            unsigned c;
+            if (std::sscanf(s + 2, "%4x", &c) != 1) return false;
+            out += (char)c;
+            s += 5;
+        } else if (s[1]) {
+            out += *++s;
+        }
+    }
+    if (*s != '"') return false;
+    *p = s + 1;
+    return true;
+}
+
+// 0 with the size and text of the file filled in
+static int scan_fd(int fd, unsigned *width, unsigned *height, entry *e) {
+    std::vector<unsigned char> head(HEAD_BYTES);
+    size_t have = 0;
+    for (;;) {
+        while (have < head.size()) {
+            ssize_t n = pread(fd, head.data() + have, head.size() - have, have);
+            if (n <= 0) break;
+            have += n;
+        }
+        e->text.clear();
+        long need = pngtext_scan(head.data(), have, width, height, on_text, e);
+        if (need == 0) return 0;
+        // broken, cut short, or with more before the pixels than a screenshot has
+        if (need < 0 || have < head.size() || need > MAX_HEAD) return -1;
+        head.resize(need);
+    }
+}
+
+static long long mtime_ns(const struct stat &st) {
+    return (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+// e is NULL for a file that is not a PNG
+static std::string format_line(const char *name, const struct stat &st, unsigned width, unsigned height,
+                               const entry *e) {
+    std::string line = "{\"file\":";
+    json_string(line, name);
+    char nums[128];
+    if (!e) {
+        std::snprintf(nums, sizeof(nums), ",\"mtime\":%lld,\"size\":%lld,\"error\":\"not a PNG\"}",
+                      mtime_ns(st), (long long)st.st_size);
+        return line + nums;
+    }
+    std::snprintf(nums, sizeof(nums), ",\"mtime\":%lld,\"size\":%lld,\"width\":%u,\"height\":%u,\"text\":{",
+                  mtime_ns(st), (long long)st.st_size, width, height);
+    line += nums;
+    for (size_t k = 0; k < e->text.size(); k++) {
+        if (k) line += ',';
+        json_string(line, e->text[k].first.c_str());
+        line += ':';
+        json_string(line, e->text[k].second.c_str());
+    }
+    line += "}}";
+    return line;
+}
+
+// Lines of an index written before, by file name; anything that does not
+// parse is read again
+static void load_index(const char *path, std::map<std::string, indexed> &index) {
+    FILE *f = std::fopen(path, "r");
+    if (!f) return;
+    char *buf = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    std::string name;
+    while ((len = getline(&buf, &cap, f)) > 0) {
+        if (buf[len - 1] == '\n') buf[--len] = 0;
+        const char *p;
+        indexed ix;
+        if (std::strncmp(buf, "{\"file\":", 8) || !json_unstring(buf + 8, &p, name) ||
+            std::sscanf(p, ",\"mtime\":%lld,\"size\":%lld", &ix.mtime_ns, &ix.size) != 2)
+            continue;
+        ix.line.assign(buf, len);
+        ix.seen = false;
+        index[name] = ix;
+    }
+    std::free(buf);
+    std::fclose(f);
+}
+
+static bool is_png(const char *name) {
+    size_t len = std::strlen(name);
+    return len > 4 && !strcasecmp(name + len - 4, ".png");
+}
+
+// Every PNG under dirfd, prefix is its path from the indexed directory.  A
+// file whose mtime and size match its line is not opened.
+static void walk(int dirfd, const std::string &prefix, bool recursive,
+                 std::map<std::string, indexed> &index, index_stats *stats) {
+    DIR *dir = fdopendir(dirfd);
+    if (!dir) {
+        close(dirfd);
+        return;
+    }
+    struct dirent *de;
+    entry e;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        bool dir_entry = de->d_type == DT_DIR;
+        bool unknown = de->d_type == DT_UNKNOWN || de->d_type == DT_LNK;
+        if (!dir_entry && !unknown && !is_png(de->d_name)) continue;
+        if (!recursive && dir_entry) continue;
+
+        struct stat st;
+        if (fstatat(dirfd, de->d_name, &st, 0)) continue;
+        std::string name = prefix + de->d_name;
+        if (S_ISDIR(st.st_mode)) {
+            // a link could lead back up
+            if (!recursive || de->d_type == DT_LNK) continue;
+            int sub = openat(dirfd, de->d_name, O_RDONLY | O_DIRECTORY);
+            if (sub >= 0) walk(sub, name + "/", recursive, index, stats);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) || !is_png(de->d_name)) continue;
+
+        stats->files++;
+        std::map<std::string, indexed>::iterator it = index.find(name);
+        if (it != index.end() && it->second.mtime_ns == mtime_ns(st) && it->second.size == st.st_size) {
+            it->second.seen = true;
+            continue;
+        }
+        int fd = openat(dirfd, de->d_name, O_RDONLY);
+        unsigned width = 0, height = 0;
+        stats->read++;
+        indexed ix = { mtime_ns(st), (long long)st.st_size, std::string(), true };
+        if (fd < 0 || scan_fd(fd, &width, &height, &e)) {
+            // kept as well, so it is not read again until it changes
+            std::fprintf(stderr, "%s: not a PNG\n", name.c_str());
+            stats->failed++;
+            ix.line = format_line(name.c_str(), st, 0, 0, NULL);
+        } else {
+            ix.line = format_line(name.c_str(), st, width, height, &e);
+        }
+        if (fd >= 0) close(fd);
+        index[name] = ix;
+    }
+    closedir(dir);
+}
+
+// Brings the index of dir up to date, written to a temporary file first so a
+// reader never sees half of it
+static int index_dir(const char *dir, const char *index_path, bool recursive, FILE *out) {
+    index_clock::time_point start = index_clock::now();
+    std::string path = index_path ? index_path : std::string(dir) + "/" INDEX_NAME;
+    std::map<std::string, indexed> index;
+    load_index(path.c_str(), index);
+
+    int dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dirfd < 0) {
+        std::perror(dir);
+        return 1;
+    }
+    index_stats stats = { 0, 0, 0, 0 };
+    walk(dirfd, "", recursive, index, &stats);
+
+    std::string tmp = path + ".tmp";
+    FILE *f = std::fopen(tmp.c_str(), "w");
+    if (!f) {
+        std::perror(tmp.c_str());
+        return 1;
+    }
+    for (std::map<std::string, indexed>::iterator it = index.begin(); it != index.end(); ++it) {
+        if (!it->second.seen) {
+            stats.removed++;
+            continue;
+        }
+        std::fputs(it->second.line.c_str(), f);
+        std::fputc('\n', f);
+        if (out) {
+            std::fputs(it->second.line.c_str(), out);
+            std::fputc('\n', out);
+        }
+    }
+    if (std::fclose(f) || std::rename(tmp.c_str(), path.c_str())) {
+        std::perror(path.c_str());
+        std::remove(tmp.c_str());
+        return 1;
+    }
+    double ms = std::chrono::duration<double, std::milli>(index_clock::now() - start).count();
+    std::fprintf(stderr, "%s: %d files, %d read, %d not PNG, %d gone, %.1f ms\n", path.c_str(),
+                 stats.files, stats.read, stats.failed, stats.removed, ms);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    std::fprintf(stderr,
+        "Usage: %s [options] FILE.png...\n"
+        "       %s [options] -d DIR\n"
+        "  -d DIR            keep the index of the PNGs in DIR up to date, only new and\n"
+        "                    changed files are read\n"
+        "  -i FILE           the index for -d (DIR/" INDEX_NAME ")\n"
+        "  -r                with -d, include subdirectories\n"
+        "  -p                with -d, also print the index\n"
+        "  -o FILE           write the JSON lines to FILE instead of stdout\n"
+        "Every PNG gets {\"file\", \"mtime\", \"size\", \"width\", \"height\", \"text\": {key: value}},\n"
+        "in the index a file that is not one gets \"error\" instead.\n",
+        prog, prog);
+}
+
+int main(int argc, char **argv) {
+    FILE *out = stdout;
+    const char *dir = NULL;
+    const char *index_path = NULL;
+    bool recursive = false, print = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:i:rpo:h")) != -1) {
+        switch (opt) {
+            case 'd': dir = optarg; break;
+            case 'i': index_path = optarg; break;
+            case 'r': recursive = true; break;
+            case 'p': print = true; break;
+            case 'o':
+                out = std::fopen(optarg, "w");
+                if (!out) {
+                    std::perror(optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (dir ? optind != argc : optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int failed = 0;
+    if (dir) {
+        failed = index_dir(dir, index_path, recursive, print ? out : NULL);
+    } else {
+        entry e;
+        for (int i = optind; i < argc; i++) {
+            unsigned width = 0, height = 0;
+            struct stat st;
+            int fd = open(argv[i], O_RDONLY);
+            if (fd < 0 || fstat(fd, &st) || scan_fd(fd, &width, &height, &e)) {
+                std::fprintf(stderr, "%s: not a PNG\n", argv[i]);
+                failed++;
+                if (fd >= 0) close(fd);
+                continue;
+            }
+            close(fd);
+            std::fputs(format_line(argv[i], st, width, height, &e).c_str(), out);
+            std::fputc('\n', out);
+        }
+    }
+    if (out != stdout) std::fclose(out);
+    return failed ? 1 : 0;
+}
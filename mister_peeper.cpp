@@ -3,370 +3,220 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
+#include <getopt.h>
+#include <signal.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <sys/types.h>
 
-// Minimal scaler + shared memory implementation so the tool is standalone
-typedef struct {
-    int header;
-    int width;
-    int height;
-    int line;
-    int output_width;
-    int output_height;
-
-    char *map;
-    int num_bytes;
-    int map_off;
-} mister_scaler;
-
-#define MISTER_SCALER_BASEADDR   0x20000000
-#define MISTER_SCALER_BUFFERSIZE (2048*3*1024)
-#define fpga_mem(x) (0x20000000 | ((x) & 0x1FFFFFFF))
-
-void mister_scaler_free(mister_scaler *ms);
-
-// --- shared memory helpers ---
-static int memfd = -1;
-
-void *shmem_map(uint32_t address, uint32_t size) {
-    if (memfd < 0) {
-        memfd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC);
-        if (memfd == -1) {
-            std::printf("Error: Unable to open /dev/mem!\n");
-            return 0;
+#include "capture.h"
+#include "detector.h"
+
+// Sample a fixed grid of pixels.  The grid size does not depend on the
+// resolution, so the cost per poll stays constant on uncached memory.
+static void sample_grid(const mister_capture &cap, int grid_w, int grid_h,
+                        uint32_t *out) {
+    const mister_pixfmt &pf = cap.format();
+    int width = cap->width, height = cap->height;
+    for (int gy = 0; gy < grid_h; gy++) {
+        const unsigned char *row = cap.row((2 * gy + 1) * height / (2 * grid_h));
+        for (int gx = 0; gx < grid_w; gx++) {
+            int x = (2 * gx + 1) * width / (2 * grid_w);
+            *out++ = (pf.bpp && height) ? mister_pixel_rgb(row + x * pf.bpp, &pf) : 0;
         }
     }
-    void *res = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, address);
-    if (res == MAP_FAILED) {
-        std::printf("Error: Unable to mmap (0x%X, %d)!\n", address, size);
-        return 0;
-    }
-    return res;
 }
 
-int shmem_unmap(void *map, uint32_t size) {
-    if (munmap(map, size) < 0) {
-        std::printf("Error: Unable to unmap(%p, %d)!\n", map, size);
-        return 0;
-    }
-    return 1;
-}
+static volatile sig_atomic_t running = 1;
 
-int shmem_put(uint32_t address, uint32_t size, void *buf) {
-    void *shmem = shmem_map(address, size);
-    if (shmem) {
-        std::memcpy(shmem, buf, size);
-        shmem_unmap(shmem, size);
-    }
-    return shmem != 0;
+static void on_signal(int) {
+    running = 0;
 }
 
-int shmem_get(uint32_t address, uint32_t size, void *buf) {
-    void *shmem = shmem_map(address, size);
-    if (shmem) {
-        std::memcpy(buf, shmem, size);
-        shmem_unmap(shmem, size);
-    }
-    return shmem != 0;
+// "FRAC[,SECS]", a fraction of 0 disables the rule
+static bool parse_rule(const char *arg, detector_rule *rule) {
+    double frac = 0, secs = rule->hold_secs;
+    int n = std::sscanf(arg, "%lf,%lf", &frac, &secs);
+    if (n < 1 || frac < 0 || frac > 1 || secs < 0) return false;
+    rule->enabled = frac > 0;
+    rule->enter = frac;
+    if (rule->exit > frac) rule->exit = frac;
+    rule->hold_secs = secs;
+    return true;
 }
 
-// --- scaler access ---
-mister_scaler *mister_scaler_init() {
-    mister_scaler *ms = (mister_scaler*)std::calloc(1, sizeof(mister_scaler));
-    int pagesize = sysconf(_SC_PAGE_SIZE);
-    if (pagesize == 0) pagesize = 4096;
-    int offset = MISTER_SCALER_BASEADDR;
-    int map_start = offset & ~(pagesize - 1);
-    ms->map_off = offset - map_start;
-    ms->num_bytes = MISTER_SCALER_BUFFERSIZE;
-
-    ms->map = (char*)shmem_map(map_start, ms->num_bytes + ms->map_off);
-    if (!ms->map) {
-        mister_scaler_free(ms);
-        return nullptr;
-    }
-
-    volatile unsigned char *buffer = (volatile unsigned char *)(ms->map + ms->map_off);
-    if (buffer[0] != 1 || buffer[1] != 1) {
-        std::fprintf(stderr, "problem\n");
-        mister_scaler_free(ms);
-        return nullptr;
-    }
-
-    ms->header       = buffer[2]  << 8 | buffer[3];
-    ms->width        = buffer[6]  << 8 | buffer[7];
-    ms->height       = buffer[8]  << 8 | buffer[9];
-    ms->line         = buffer[10] << 8 | buffer[11];
-    ms->output_width = buffer[12] << 8 | buffer[13];
-    ms->output_height= buffer[14] << 8 | buffer[15];
-    return ms;
+static void usage(const char *prog) {
+    std::fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -i, --interval MS        poll interval (default 100)\n"
+        "  -g, --grid WxH           sample grid (default 64x36)\n"
+        "  -q, --quiet              no status line\n"
+        "      --static SECS        still screen for SECS activates 'static' (0 = off)\n"
+        "      --still FRAC         fraction of unchanged samples counted as still (0.99)\n"
+        "      --black FRAC[,SECS]  fraction of black samples for 'black' (0.95,5)\n"
+        "      --black-level N      max luma counted as black, 0-255 (24)\n"
+        "      --dominant FRAC[,SECS] fraction in one colour for 'dominant' (0.90,30)\n"
+        "      --release SECS       time a condition must be gone before clearing\n"
+        "      --exec CMD           run CMD on every transition, with\n"
+        "                           DETECT_EVENT and DETECT_STATE in the environment\n"
+        "      --flag-dir DIR       keep DIR/<event> while a rule is active\n"
+        "      --pidfile FILE       send SIGUSR1/SIGUSR2 to the pid in FILE\n",
+        prog);
 }
 
-void mister_scaler_free(mister_scaler *ms) {
-    if (ms) {
-        shmem_unmap(ms->map, ms->num_bytes + ms->map_off);
-        std::free(ms);
-    }
-}
-
-int mister_scaler_read(mister_scaler *ms, unsigned char *gbuf) {
-    volatile unsigned char *buffer = (volatile unsigned char *)(ms->map + ms->map_off);
-    for (int y = 0; y < ms->height; y++) {
-        std::memcpy(&gbuf[y*(ms->width*3)],
-                    const_cast<const void*>(static_cast<volatile const void*>(&buffer[ms->header + y*ms->line])),
-                    ms->width*3);
-    }
-    return 0;
-}
-
-int mister_scaler_read_32(mister_scaler *ms, unsigned char *gbuf) {
-    volatile unsigned char *buffer = (volatile unsigned char *)(ms->map + ms->map_off);
-    volatile unsigned char *pixbuf;
-    unsigned char *outbuf;
-    for (int y = 0; y < ms->height; y++) {
-        pixbuf = &buffer[ms->header + y*ms->line];
-        outbuf = &gbuf[y*(ms->width*4)];
-        for (int x = 0; x < ms->width; x++) {
-            outbuf[2] = *pixbuf++;
-            outbuf[1] = *pixbuf++;
-            outbuf[0] = *pixbuf++;
-            outbuf[3] = 0xFF;
-            outbuf += 4;
-        }
-    }
-    return 0;
-}
-
-int mister_scaler_read_yuv(mister_scaler *ms, int lineY, unsigned char *bufY,
-                           int lineU, unsigned char *bufU,
-                           int lineV, unsigned char *bufV) {
-    volatile unsigned char *buffer = (volatile unsigned char *)(ms->map + ms->map_off);
-    for (int y = 0; y < ms->height; y++) {
-        volatile unsigned char *pixbuf = &buffer[ms->header + y*ms->line];
-        unsigned char *outbufy = &bufY[y*lineY];
-        unsigned char *outbufU = &bufU[y*lineU];
-        unsigned char *outbufV = &bufV[y*lineV];
-        for (int x = 0; x < ms->width; x++) {
-            int R = *pixbuf++;
-            int G = *pixbuf++;
-            int B = *pixbuf++;
-            int Y =  (0.257 * R) + (0.504 * G) + (0.098 * B) + 16;
-            int U = -(0.148 * R) - (0.291 * G) + (0.439 * B) + 128;
-            int V =  (0.439 * R) - (0.368 * G) - (0.071 * B) + 128;
-            *outbufy++ = Y;
-            *outbufU++ = U;
-            *outbufV++ = V;
-        }
-    }
-    return 0;
-}
-
-// Sampled FNV-1a hash to cheaply detect changes
-static uint64_t sample_hash(const volatile unsigned char *base, int width, int height,
-                            int line, int bpp, int step) {
-    uint64_t hash = 1469598103934665603ULL;
-    const uint64_t prime = 1099511628211ULL;
-    for (int y = 0; y < height; y += step) {
-        const volatile unsigned char *row = base + y * line;
-        for (int x = 0; x < width; x += step) {
-            const volatile unsigned char *p = row + x * bpp;
-            for (int i = 0; i < bpp; ++i) {
-                hash ^= p[i];
-                hash *= prime;
+int main(int argc, char **argv) {
+    detector_config cfg;
+    detector_defaults(&cfg);
+    int interval_ms = 100;
+    int grid_w = 64, grid_h = 36;
+    bool quiet = false;
+
+    enum { OPT_STATIC = 256, OPT_STILL, OPT_BLACK, OPT_BLACK_LEVEL, OPT_DOMINANT,
+           OPT_RELEASE, OPT_EXEC, OPT_FLAG_DIR, OPT_PIDFILE };
+    static const struct option long_opts[] = {
+        { "interval",    required_argument, nullptr, 'i' },
+        { "grid",        required_argument, nullptr, 'g' },
+        { "quiet",       no_argument,       nullptr, 'q' },
+        { "static",      required_argument, nullptr, OPT_STATIC },
+        { "still",       required_argument, nullptr, OPT_STILL },
+        { "black",       required_argument, nullptr, OPT_BLACK },
+        { "black-level", required_argument, nullptr, OPT_BLACK_LEVEL },
+        { "dominant",    required_argument, nullptr, OPT_DOMINANT },
+        { "release",     required_argument, nullptr, OPT_RELEASE },
+        { "exec",        required_argument, nullptr, OPT_EXEC },
+        { "flag-dir",    required_argument, nullptr, OPT_FLAG_DIR },
+        { "pidfile",     required_argument, nullptr, OPT_PIDFILE },
+        { "help",        no_argument,       nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    int opt;
+    bool ok = true;
+    while (ok && (opt = getopt_long(argc, argv, "i:g:qh", long_opts, nullptr)) != -1) {
+        switch (opt) {
+            case 'i':
+                interval_ms = std::atoi(optarg);
+                ok = interval_ms > 0;
+                break;
+            case 'g':
+                ok = std::sscanf(optarg, "%dx%d", &grid_w, &grid_h) == 2 &&
+                     grid_w > 0 && grid_h > 0 && grid_w * grid_h <= 16384;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            case OPT_STATIC: {
+                double secs = std::atof(optarg);
+                cfg.rule[DETECT_STATIC].enabled = secs > 0;
+                cfg.rule[DETECT_STATIC].hold_secs = secs;
+                break;
             }
+            case OPT_STILL:
+                ok = parse_rule(optarg, &cfg.rule[DETECT_STATIC]) &&
+                     cfg.rule[DETECT_STATIC].enabled;
+                break;
+            case OPT_BLACK:
+                ok = parse_rule(optarg, &cfg.rule[DETECT_BLACK]);
+                break;
+            case OPT_BLACK_LEVEL:
+                cfg.black_level = std::atoi(optarg);
+                ok = cfg.black_level >= 0 && cfg.black_level <= 255;
+                break;
+            case OPT_DOMINANT:
+                ok = parse_rule(optarg, &cfg.rule[DETECT_DOMINANT]);
+                break;
+            case OPT_RELEASE:
+                for (int i = 0; i < DETECT_COUNT; i++)
+                    cfg.rule[i].release_secs = std::atof(optarg);
+                break;
+            case OPT_EXEC:     cfg.command  = optarg; break;
+            case OPT_FLAG_DIR: cfg.flag_dir = optarg; break;
+            case OPT_PIDFILE:  cfg.pidfile  = optarg; break;
+            default:
+                ok = false;
+                break;
         }
     }
-    return hash;
-}
-
-static uint32_t dominant_color(const volatile unsigned char *base, int width, int height,
-                               int line, int bpp, int step, bool is_bgr, bool is_1555) {
-    uint32_t counts[4096];
-    memset(counts, 0, sizeof(counts));
-
-    for (int y = 0; y < height; y += step) {
-        const volatile unsigned char *pix = base + y * line;
-        for (int x = 0; x < width; x += step) {
-            int r = 0, g = 0, b = 0;
-            if (bpp == 1) {
-                r = g = b = pix[0];
-                pix += 1 * step;
-            } else if (bpp == 2) {
-                uint16_t v = static_cast<uint16_t>(pix[0]) |
-                             (static_cast<uint16_t>(pix[1]) << 8);
-                if (is_1555) {
-                    r = (v >> 10) & 0x1F;
-                    g = (v >> 5) & 0x1F;
-                    b = v & 0x1F;
-                    r = (r << 3) | (r >> 2);
-                    g = (g << 3) | (g >> 2);
-                    b = (b << 3) | (b >> 2);
-                } else {
-                    r = (v >> 11) & 0x1F;
-                    g = (v >> 5) & 0x3F;
-                    b = v & 0x1F;
-                    r = (r << 3) | (r >> 2);
-                    g = (g << 2) | (g >> 4);
-                    b = (b << 3) | (b >> 2);
-                }
-                if (is_bgr) { int tmp = r; r = b; b = tmp; }
-            } else if (bpp == 4) {
-                if (is_bgr) {
-                    b = pix[0];
-                    g = pix[1];
-                    r = pix[2];
-                } else {
-                    r = pix[0];
-                    g = pix[1];
-                    b = pix[2];
-                }
-                pix += 4 * step;
-            } else {
-                if (is_bgr) {
-                    b = pix[0];
-                    g = pix[1];
-                    r = pix[2];
-                } else {
-                    r = pix[0];
-                    g = pix[1];
-                    b = pix[2];
-                }
-                pix += 3 * step;
-            }
-            int idx = ((r >> 4) << 8) | ((g >> 4) << 4) | (b >> 4);
-            counts[idx]++;
-        }
+    if (!ok || optind < argc) {
+        usage(argv[0]);
+        return 1;
     }
 
-    uint32_t best = 0;
-    for (int i = 1; i < 4096; ++i) {
-        if (counts[i] > counts[best]) best = i;
+    mister_capture cap;
+    if (!cap) {
+        std::fprintf(stderr, "scaler init failed\n");
+        return 1;
     }
-    int r = ((best >> 8) & 0xF) * 17;
-    int g = ((best >> 4) & 0xF) * 17;
-    int b = (best & 0xF) * 17;
-    return (r << 16) | (g << 8) | b;
-}
 
-int main(int, char**) {
-    mister_scaler *ms = mister_scaler_init();
-    if (!ms) {
-        std::fprintf(stderr, "scaler init failed\n");
+    detector det;
+    std::vector<uint32_t> samples(grid_w * grid_h);
+    if (!detector_init(&det, &cfg, grid_w * grid_h)) {
+        std::fprintf(stderr, "out of memory\n");
         return 1;
     }
 
-    volatile unsigned char *buffer =
-        (volatile unsigned char *)(ms->map + ms->map_off);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
 
-    auto last_change = std::chrono::steady_clock::now();
+    auto start = std::chrono::steady_clock::now();
+    auto last_change = start;
     uint64_t last_hash = 0;
-    uint32_t last_color = 0;
     bool first = true;
-    const int step = 4; // sample every 4th pixel to reduce CPU usage
 
-    // Track current scaler state.  These values may change even when the
-    // framebuffer offset remains the same, so refresh them every iteration.
-    int header = ms->header;
-    int width  = ms->width;
-    int height = ms->height;
-    int line   = ms->line;
-    int out_w  = ms->output_width;
-    int out_h  = ms->output_height;
-    int bpp    = 0;
+    while (running) {
+        // The geometry may change even when the framebuffer offset remains
+        // the same, so refresh it every iteration.
+        bool meta_changed = cap.refresh();
 
-    while (1) {
-        int new_header = buffer[2] << 8 | buffer[3];
-        int new_width  = buffer[6]  << 8 | buffer[7];
-        int new_height = buffer[8]  << 8 | buffer[9];
-        int new_line   = buffer[10] << 8 | buffer[11];
-        int new_out_w  = buffer[12] << 8 | buffer[13];
-        int new_out_h  = buffer[14] << 8 | buffer[15];
-        int fmt        = buffer[4];
-        int new_bpp    = 0;
-        bool is_bgr    = (fmt & 0x10) != 0;
-        bool is_1555   = false;
-        const char *pixfmt = "Unknown";
-
-        switch (fmt & 0x7) {
-            case 0x0:
-                new_bpp = 1;
-                pixfmt = "PAL8";
-                break;
-            case 0x1:
-                new_bpp = 2;
-                is_1555 = (fmt & 0x8) != 0;
-                if (is_1555) pixfmt = is_bgr ? "BGR1555" : "RGB1555";
-                else         pixfmt = is_bgr ? "BGR565"  : "RGB565";
-                break;
-            case 0x2:
-                new_bpp = 3;
-                pixfmt = is_bgr ? "BGR888" : "RGB888";
-                break;
-            case 0x3:
-                new_bpp = 4;
-                pixfmt = is_bgr ? "ABGR8888" : "ARGB8888";
-                break;
-            default: {
-                static char unknown[16];
-                std::snprintf(unknown, sizeof(unknown), "fmt=%02X", fmt);
-                pixfmt = unknown;
-                break;
-            }
-        }
-
-        bool meta_changed = (new_header != header) || (new_width != width) ||
-                            (new_height != height) || (new_line != line) ||
-                            (new_bpp != bpp);
-
-        header = new_header;
-        width  = new_width;
-        height = new_height;
-        line   = new_line;
-        out_w  = new_out_w;
-        out_h  = new_out_h;
-        bpp    = new_bpp;
-
-        uint8_t hdr5 = buffer[5];
-        (void)out_w;
-        (void)out_h;
-        (void)hdr5;
-
-        const volatile unsigned char *frame = buffer + header;
-        uint64_t hash =
-            sample_hash(frame, width, height, line, bpp, step);
-        uint32_t color =
-            dominant_color(frame, width, height, line, bpp, step, is_bgr, is_1555);
+        sample_grid(cap, grid_w, grid_h, samples.data());
+        detector_stats st;
+        detector_measure(&det, samples.data(), &st);
         auto now = std::chrono::steady_clock::now();
 
-        if (first || meta_changed || hash != last_hash) {
-            last_hash = hash;
-            last_color = color;
+        if (first || meta_changed || st.hash != last_hash) {
+            last_hash = st.hash;
             last_change = now;
             first = false;
         }
 
-        double secs =
-            std::chrono::duration<double>(now - last_change).count();
+        int active = detector_update(&det, &st,
+            std::chrono::duration<double>(now - start).count());
 
-        const char *endian =
+        if (!quiet) {
+            double secs =
+                std::chrono::duration<double>(now - last_change).count();
+
+            const char *endian =
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-            "little";
+                "little";
 #else
-            "big";
+                "big";
 #endif
 
-        char status[256];
-        std::snprintf(status, sizeof(status),
-                      "%dx%d %d-bit %s %s %.2fs rgb=%06X",
-                      width, height, bpp * 8, pixfmt, endian, secs,
-                      last_color);
-        std::printf("\r%-80s", status);
-        std::fflush(stdout);
-        usleep(50000);
+            char flags[DETECT_COUNT * 10 + 1] = "";
+            for (int i = 0; i < DETECT_COUNT; i++) {
+                if (active & (1 << i)) {
+                    std::strcat(flags, " ");
+                    std::strcat(flags, detector_name(i));
+                }
+            }
+
+            const mister_pixfmt &pf = cap.format();
+            char pixfmt[16];
+            if (pf.bpp) std::snprintf(pixfmt, sizeof(pixfmt), "%s", pf.name);
+            else        std::snprintf(pixfmt, sizeof(pixfmt), "fmt=%02X", cap->format);
+
+            char status[256];
+            std::snprintf(status, sizeof(status),
+                          "%dx%d %d-bit %s %s %.2fs rgb=%06X%s",
+                          cap->width, cap->height, pf.bpp * 8, pixfmt, endian, secs,
+                          st.color, flags);
+            std::printf("\r%-80s", status);
+            std::fflush(stdout);
+        }
+        usleep(interval_ms * 1000);
     }
+
+    if (!quiet) std::printf("\n");
+    detector_free(&det);
     return 0;
 }
@@ -0,0 +1,233 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "lodepng.h"
+#include "scaler.h"
+#include "stream.h"
+
+// Receives frames from mister_stream and writes them as YUV4MPEG2 (4:4:4)
+// or as a numbered PNG sequence.  Frames the server dropped are repeated in
+// the Y4M output so its timing stays right; PNGs are named by frame number.
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int) {
+    running = 0;
+}
+
+static bool read_full(int fd, void *buf, size_t n) {
+    uint8_t *p = (uint8_t *)buf;
+    while (n) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) {
+            if (!running) return false;
+            continue;
+        }
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+// A frame is at most what fits the ASCAL buffer, twice that for one woven
+// from two fields (mister_stream -i weave)
+#define MAX_FRAME_BYTES (2 * (size_t)MISTER_SCALER_BUFFERSIZE)
+
+// Size of the decoded frame, 0 when the header does not describe a frame a
+// server could have sent; checked before anything is allocated for it
+static size_t frame_bytes(const stream_header &h) {
+    mister_pixfmt pf = mister_pixfmt_decode(h.format);
+    size_t size = (size_t)h.width * pf.bpp * h.height;
+    if (!size || size > MAX_FRAME_BYTES) return 0;
+    if (h.encoding == STREAM_RAW) return h.size == size ? size : 0;
+    if (h.encoding == STREAM_RLE || h.encoding == STREAM_DELTA)
+        return h.size <= stream_rle_bound(size) ? size : 0;
+    return 0;
+}
+
+// Integer BT.601 like mister_scaler_read_yuv
+static void write_y4m_frame(FILE *f, const std::vector<uint8_t> &rgb, int w, int h,
+                            std::vector<uint8_t> &planes) {
+    size_t n = (size_t)w * h;
+    planes.resize(n * 3);
+    for (size_t i = 0; i < n; i++) {
+        int R = rgb[i * 3], G = rgb[i * 3 + 1], B = rgb[i * 3 + 2];
+        planes[i]         = (( 66 * R + 129 * G +  25 * B + 128) >> 8) + 16;
+        planes[n + i]     = ((-38 * R -  74 * G + 112 * B + 128) >> 8) + 128;
+        planes[2 * n + i] = ((112 * R -  94 * G -  18 * B + 128) >> 8) + 128;
+    }
+    std::fputs("FRAME\n", f);
+    std::fwrite(planes.data(), 1, planes.size(), f);
+}
+
+static void usage(const char *prog) {
+    std::fprintf(stderr,
+        "Usage: %s [options] <[host:]port | unix:/path>\n"
+        "  -o FILE     write YUV4MPEG2, \"-\" for stdout\n"
+        "  -p PREFIX   write PREFIX000123.png for every frame\n"
+        "  -r FPS      frame rate in the Y4M header (60)\n"
+        "  -n N        stop after N frames\n"
+        "  -d MS       wait MS after every frame, to try out a slow client\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    const char *y4m_name = nullptr;
+    const char *png_prefix = nullptr;
+    int fps = 60;
+    long limit = 0;
+    int delay_ms = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:p:r:n:d:h")) != -1) {
+        switch (opt) {
+            case 'o': y4m_name = optarg; break;
+            case 'p': png_prefix = optarg; break;
+            case 'r': fps = std::atoi(optarg); break;
+            case 'n': limit = std::atol(optarg); break;
+            case 'd': delay_ms = std::atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || fps < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *y4m = nullptr;
+    if (y4m_name) {
+        y4m = std::strcmp(y4m_name, "-") ? std::fopen(y4m_name, "wb") : stdout;
+        if (!y4m) {
+            std::fprintf(stderr, "unable to open %s\n", y4m_name);
+            return 1;
+        }
+    }
+
+    int fd = stream_connect(argv[optind]);
+    if (fd < 0) return 1;
+
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    std::vector<uint8_t> payload, frame, delta, rgb, planes;
+    int width = 0, height = 0;
+    uint32_t last_frame = 0, server_dropped = 0;
+    long frames = 0, gaps = 0, repeated = 0;
+    uint64_t bytes = 0, raw_bytes = 0;
+    bool ok = true;
+
+    while (running && (!limit || frames < limit)) {
+        stream_header h;
+        if (!read_full(fd, &h, sizeof(h))) break;
+        if (std::memcmp(h.magic, STREAM_MAGIC, 4) || h.version != STREAM_VERSION) {
+            std::fprintf(stderr, "not a mister_stream\n");
+            ok = false;
+            break;
+        }
+        size_t size = frame_bytes(h);
+        if (!size) {
+            std::fprintf(stderr, "frame %u: bad header, %ux%u format 0x%02x encoding %u with %u bytes, "
+                         "dropping the connection\n", h.frame, h.width, h.height, h.format, h.encoding, h.size);
+            ok = false;
+            break;
+        }
+        payload.resize(h.size);
+        if (!read_full(fd, payload.data(), h.size)) break;
+
+        mister_pixfmt pf = mister_pixfmt_decode(h.format);
+        if (h.encoding == STREAM_DELTA && frame.size() != size) {
+            std::fprintf(stderr, "frame %u: delta without a whole frame before it\n", h.frame);
+            ok = false;
+            break;
+        }
+
+        long n;
+        if (h.encoding == STREAM_RAW) {
+            frame.assign(payload.begin(), payload.end());
+            n = frame.size();
+        } else if (h.encoding == STREAM_RLE) {
+            frame.resize(size);
+            n = stream_rle_decode(payload.data(), h.size, frame.data(), size);
+        } else {
+            delta.resize(size);
+            n = stream_rle_decode(payload.data(), h.size, delta.data(), size);
+            stream_xor(frame.data(), delta.data(), frame.data(), size);
+        }
+        if (n != (long)size) {
+            std::fprintf(stderr, "frame %u: corrupt payload\n", h.frame);
+            ok = false;
+            break;
+        }
+        bytes += sizeof(h) + h.size;
+        raw_bytes += sizeof(h) + size;
+
+        // frames that should have come in between
+        long missing = 0;
+        if (frames && h.step)
+            missing = (long)(h.frame / h.step) - (long)(last_frame / h.step) - 1;
+        if (missing > 0) gaps += missing;
+
+        if (y4m) {
+            if (!width) {
+                width = h.width;
+                height = h.height;
+                std::fprintf(y4m, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+            } else if (width != h.width || height != h.height) {
+                std::fprintf(stderr, "the core switched to %dx%d, stopping\n", h.width, h.height);
+                break;
+            }
+            // keep the timing, show the last picture for the frames that are
+            // missing, rgb still holds it
+            for (long i = 0; i < missing; i++) {
+                write_y4m_frame(y4m, rgb, width, height, planes);
+                repeated++;
+            }
+        }
+
+        rgb.resize((size_t)h.width * h.height * 3);
+        for (int y = 0; y < h.height; y++)
+            mister_row_rgb24(&frame[(size_t)y * h.width * pf.bpp], &rgb[(size_t)y * h.width * 3],
+                             h.width, &pf);
+        if (y4m) write_y4m_frame(y4m, rgb, width, height, planes);
+        if (png_prefix) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%06u.png", h.frame);
+            std::string path = std::string(png_prefix) + name;
+            unsigned error = lodepng_encode24_file(path.c_str(), rgb.data(), h.width, h.height);
+            if (error) {
+                std::fprintf(stderr, "%s: %s\n", path.c_str(), lodepng_error_text(error));
+                ok = false;
+                break;
+            }
+        }
+
+        last_frame = h.frame;
+        server_dropped = h.dropped;
+        frames++;
+        if (delay_ms) usleep(delay_ms * 1000);
+    }
+
+    std::fprintf(stderr,
+        "%ld frames, %ld missing (%u dropped by the server), %ld repeated, "
+        "%.1f MB received, %.2fx compression\n",
+        frames, gaps, server_dropped, repeated, bytes / 1e6,
+        bytes ? (double)raw_bytes / bytes : 0.0);
+
+    close(fd);
+    if (y4m && y4m != stdout) std::fclose(y4m);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,283 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "scaler.h"
+#include "stream.h"
+
+// Streams every frame of the core to one client at a time for encoding
+// off the device, e.g.
+//   mister_stream -e delta 7777
+//   mister_recv -o out.y4m mister:7777
+// The capture loop never blocks on the client: a frame that finds the
+// previous one still unsent is dropped and counted.
+
+const char *version = "$VER:MisterStream" VDATE;
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int) {
+    running = 0;
+}
+
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct client {
+    int fd = -1;
+    std::vector<uint8_t> out;   // message being sent
+    size_t sent = 0;
+    bool need_key = true;       // next frame must not be a delta
+    uint32_t frames = 0;
+    uint32_t dropped = 0;
+    uint64_t bytes = 0;
+    uint64_t raw_bytes = 0;
+};
+
+static void disconnect(client *c, const char *why) {
+    if (c->fd < 0) return;
+    std::fprintf(stderr, "client gone (%s): %u frames sent, %u dropped, %.1f MB, %.2fx\n",
+                 why, c->frames, c->dropped, c->bytes / 1e6,
+                 c->bytes ? (double)c->raw_bytes / c->bytes : 0.0);
+    close(c->fd);
+    c->fd = -1;
+    c->out.clear();
+    c->sent = 0;
+}
+
+// Sends as much of the pending message as the socket takes right now
+static void flush(client *c) {
+    while (c->fd >= 0 && c->sent < c->out.size()) {
+        ssize_t n = send(c->fd, c->out.data() + c->sent, c->out.size() - c->sent,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0) {
+            c->sent += n;
+            c->bytes += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            disconnect(c, n ? std::strerror(errno) : "closed");
+        }
+    }
+    if (c->sent == c->out.size()) {
+        c->out.clear();
+        c->sent = 0;
+    }
+}
+
+static void accept_client(int listen_fd, client *c) {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) return;
+    if (c->fd >= 0) {
+        // one client at a time
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    *c = client();
+    c->fd = fd;
+    std::fprintf(stderr, "client connected\n");
+}
+
+// Waits for the frame counter to move while keeping the socket busy
+static int wait_frame(mister_scaler *ms, int listen_fd, client *c, int timeout_ms) {
+    int start = mister_scaler_frame_counter(ms);
+    int64_t deadline = now_us() + (int64_t)timeout_ms * 1000;
+    while (running) {
+        int fc = mister_scaler_frame_counter(ms);
+        if (fc != start) return fc;
+        if (now_us() > deadline) return -1;
+
+        struct pollfd pfd[2];
+        int n = 0;
+        pfd[n].fd = listen_fd;
+        pfd[n++].events = POLLIN;
+        if (c->fd >= 0 && !c->out.empty()) {
+            pfd[n].fd = c->fd;
+            pfd[n++].events = POLLOUT;
+        }
+        // the frame counter can't be polled, check it every millisecond
+        if (poll(pfd, n, 1) > 0) {
+            if (pfd[0].revents & POLLIN) accept_client(listen_fd, c);
+            if (n > 1 && pfd[1].revents) flush(c);
+        }
+    }
+    return -1;
+}
+
+static void usage(const char *prog) {
+    std::fprintf(stderr,
+        "Usage: %s [options] <[host:]port | unix:/path>\n"
+        "  -e MODE   raw, rle or delta (delta)\n"
+        "  -k N      send a whole frame at least every N frames (60)\n"
+        "  -n N      send every Nth frame of the core (1)\n"
+        "  -r HZ     refresh rate of the core (measured)\n"
+        "  -i MODE   interlaced cores: weave, double or off (off)\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    int encoding = STREAM_DELTA;
+    int key_interval = 60;
+    int decimate = 1;
+    int deinterlace = MISTER_DEINTERLACE_OFF;
+    double hz = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:k:n:r:i:h")) != -1) {
+        switch (opt) {
+            case 'e':
+                if (!std::strcmp(optarg, "raw")) encoding = STREAM_RAW;
+                else if (!std::strcmp(optarg, "rle")) encoding = STREAM_RLE;
+                else if (!std::strcmp(optarg, "delta")) encoding = STREAM_DELTA;
+                else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'k': key_interval = std::atoi(optarg); break;
+            case 'n': decimate = std::atoi(optarg); break;
+            case 'r': hz = std::atof(optarg); break;
+            case 'i':
+                deinterlace = mister_deinterlace_parse(optarg);
+                if (deinterlace < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || key_interval < 1 || decimate < 1 || hz < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    mister_scaler *ms = mister_scaler_init();
+    if (!ms) {
+        std::fprintf(stderr, "some problem with the mister scaler, maybe this core doesn't support it\n");
+        return 1;
+    }
+    if (deinterlace) mister_scaler_set_deinterlace(ms, deinterlace);
+    if (hz == 0) {
+        hz = mister_scaler_measure_refresh(ms, 30);
+        if (hz == 0) {
+            std::fprintf(stderr, "the frame counter doesn't move, is the core running?\n");
+            mister_scaler_free(ms);
+            return 1;
+        }
+    }
+
+    int listen_fd = stream_listen(argv[optind]);
+    if (listen_fd < 0) {
+        mister_scaler_free(ms);
+        return 1;
+    }
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::fprintf(stderr, "streaming %dx%d %s at %.3f Hz on %s\n", ms->width, ms->height,
+                 ms->pixfmt.name, hz, argv[optind]);
+
+    client c;
+    std::vector<uint8_t> cur, prev, delta;
+    uint32_t frame = 0;
+    uint32_t last_slot = 0;
+    uint32_t since_key = 0;
+    int64_t start = now_us();
+    int64_t last = start;
+    int fc = mister_scaler_frame_counter(ms);
+
+    while (running) {
+        int nfc = wait_frame(ms, listen_fd, &c, 1000);
+        if (nfc < 0) {
+            if (running) std::fprintf(stderr, "the frame counter stopped\n");
+            continue;
+        }
+        // a stall of 8 frames or more wraps the counter, the clock tells
+        int64_t t = now_us();
+        frame += mister_frames_between((nfc - fc) & 7, (t - last) / 1e6, hz);
+        fc = nfc;
+        last = t;
+        // with -n, the first frame of every group of decimate
+        if (c.fd < 0 || frame / decimate == last_slot) continue;
+        last_slot = frame / decimate;
+
+        // the client is still busy with the last one
+        if (!c.out.empty()) {
+            c.dropped++;
+            continue;
+        }
+
+        if (mister_scaler_refresh(ms)) c.need_key = true;
+        size_t size = (size_t)ms->width * ms->pixfmt.bpp * ms->height;
+        cur.resize(size);
+        if (size) mister_scaler_read_raw(ms, cur.data());
+
+        int enc = encoding;
+        if (enc == STREAM_DELTA && (c.need_key || prev.size() != size || since_key >= (uint32_t)key_interval))
+            enc = STREAM_RLE;
+
+        stream_header h;
+        std::memcpy(h.magic, STREAM_MAGIC, 4);
+        h.version = STREAM_VERSION;
+        h.encoding = enc;
+        h.format = ms->format;
+        h.flags = mister_scaler_flags(ms);
+        h.frame = frame;
+        h.dropped = c.dropped;
+        h.time_us = now_us() - start;
+        h.width = ms->width;
+        h.height = ms->height;
+        h.step = decimate;
+        h.reserved = 0;
+
+        c.out.resize(sizeof(h) + (enc == STREAM_RAW ? size : stream_rle_bound(size)));
+        uint8_t *payload = c.out.data() + sizeof(h);
+        if (enc == STREAM_RAW) {
+            std::memcpy(payload, cur.data(), size);
+            h.size = size;
+        } else if (enc == STREAM_RLE) {
+            h.size = stream_rle_encode(cur.data(), size, payload);
+        } else {
+            delta.resize(size);
+            stream_xor(cur.data(), prev.data(), delta.data(), size);
+            h.size = stream_rle_encode(delta.data(), size, payload);
+        }
+        std::memcpy(c.out.data(), &h, sizeof(h));
+        c.out.resize(sizeof(h) + h.size);
+
+        since_key = enc == STREAM_DELTA ? since_key + 1 : 0;
+        c.need_key = false;
+        c.frames++;
+        c.raw_bytes += sizeof(h) + size;
+        // deltas are against what the client got, dropped frames don't count
+        prev.swap(cur);
+        flush(&c);
+    }
+
+    disconnect(&c, "server stopped");
+    close(listen_fd);
+    mister_scaler_free(ms);
+    return 0;
+}
@@ -0,0 +1,738 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "apng.h"
+#include "crt.h"
+#include "fake_ascal.h"
+#include "lodepng.h"
+#include "pngtext.h"
+#include "resample.h"
+#include "scaler.h"
+#include "shmem.h"
+
+// Checks the capture library against a fake ASCAL buffer: every read of every
+// pixel format is compared with fake_ascal_pixel() put through the format by
+// hand, so it runs anywhere "make HOST=1 test" builds.  The filters that work
+// on RGB24 pictures are checked on small pictures with known results.
+
+const char *version = "$VER:MisterTest" VDATE;
+
+static const char *formats[] = {
+    "PAL8", "RGB565", "RGB1555", "RGB888", "ARGB8888",
+    "BGR565", "BGR1555", "BGR888", "ABGR8888"
+};
+static const int sizes[][2] = { { 320, 240 }, { 77, 61 } };
+
+static int checks, failures;
+
+// Reports the first difference of a check, name says what was compared
+static bool check(bool ok, const char *name, const char *fmt, int w, int h, int x, int y,
+                  int got, int want) {
+    checks++;
+    if (ok) return true;
+    failures++;
+    std::printf("FAIL %s %s %dx%d at %d,%d: got 0x%06X, want 0x%06X\n", name, fmt, w, h, x, y, got, want);
+    return false;
+}
+
+// 0xRRGGBB as the format stores it and mister_pixel_rgb gives it back
+static uint32_t quantize(uint32_t c, const mister_pixfmt *pf) {
+    int r = (c >> 16) & 0xFF, g = (c >> 8) & 0xFF, b = c & 0xFF;
+    if (pf->bpp == 1) {
+        r = g = b = (77 * r + 150 * g + 29 * b) >> 8;
+    } else if (pf->bpp == 2) {
+        int gbits = pf->rgb1555 ? 5 : 6;
+        r = (r >> 3) << 3 | r >> 5;
+        g >>= 8 - gbits;
+        g = g << (8 - gbits) | g >> (2 * gbits - 8);
+        b = (b >> 3) << 3 | b >> 5;
+    }
+    return (uint32_t)r << 16 | g << 8 | b;
+}
+
+static int luma(uint32_t c) {
+    int r = c >> 16, g = (c >> 8) & 0xFF, b = c & 0xFF;
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+// R, G and B are sums of n pixels, n 1 or 4
+static int chroma_u(int r, int g, int b, int n) {
+    return n == 1 ? ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128
+                  : ((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128;
+}
+
+static int chroma_v(int r, int g, int b, int n) {
+    return n == 1 ? ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128
+                  : ((112 * r - 94 * g - 18 * b + 512) >> 10) + 128;
+}
+
+// The picture the fake shows, quantized, w x h 0xRRGGBB
+struct picture {
+    int w, h;
+    std::vector<uint32_t> px;
+    uint32_t at(int x, int y) const { return px[y * w + x]; }
+};
+
+static void test_reads(mister_scaler *ms, const char *fmt, const picture &want, int x0, int y0,
+                       const char *suffix) {
+    int w = ms->width, h = ms->height;
+    std::string name;
+    std::vector<unsigned char> rgb((size_t)w * h * 3), bgra((size_t)w * h * 4);
+
+    name = std::string("read") + suffix;
+    check(mister_scaler_read(ms, rgb.data()) == 0, name.c_str(), fmt, w, h, 0, 0, 1, 0);
+    for (int y = 0, bad = 0; y < h && !bad; y++) {
+        for (int x = 0; x < w && !bad; x++) {
+            const unsigned char *p = &rgb[(y * w + x) * 3];
+            uint32_t got = (uint32_t)p[0] << 16 | p[1] << 8 | p[2], c = want.at(x0 + x, y0 + y);
+            bad = !check(got == c, name.c_str(), fmt, w, h, x, y, got, c);
+        }
+    }
+
+    name = std::string("read_32") + suffix;
+    check(mister_scaler_read_32(ms, bgra.data()) == 0, name.c_str(), fmt, w, h, 0, 0, 1, 0);
+    for (int y = 0, bad = 0; y < h && !bad; y++) {
+        for (int x = 0; x < w && !bad; x++) {
+            const unsigned char *p = &bgra[(y * w + x) * 4];
+            uint32_t got = (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+            uint32_t c = 0xFF000000 | want.at(x0 + x, y0 + y);
+            bad = !check(got == c, name.c_str(), fmt, w, h, x, y, got, c);
+        }
+    }
+}
+
+static void test_yuv(mister_scaler *ms, const char *fmt, const picture &want) {
+    int w = ms->width, h = ms->height, cw = (w + 1) / 2, ch = (h + 1) / 2;
+    std::vector<unsigned char> Y((size_t)w * h), U((size_t)w * h), V((size_t)w * h);
+
+    check(mister_scaler_read_yuv(ms, w, Y.data(), w, U.data(), w, V.data()) == 0, "yuv", fmt, w, h, 0, 0, 1, 0);
+    for (int y = 0, bad = 0; y < h && !bad; y++) {
+        for (int x = 0; x < w && !bad; x++) {
+            uint32_t c = want.at(x, y);
+            int r = c >> 16, g = (c >> 8) & 0xFF, b = c & 0xFF, i = y * w + x;
+            bad = !check(Y[i] == luma(c), "yuv Y", fmt, w, h, x, y, Y[i], luma(c)) ||
+                  !check(U[i] == chroma_u(r, g, b, 1), "yuv U", fmt, w, h, x, y, U[i], chroma_u(r, g, b, 1)) ||
+                  !check(V[i] == chroma_v(r, g, b, 1), "yuv V", fmt, w, h, x, y, V[i], chroma_v(r, g, b, 1));
+        }
+    }
+
+    check(mister_scaler_read_i420(ms, w, Y.data(), cw, U.data(), cw, V.data()) == 0, "i420", fmt, w, h, 0, 0, 1, 0);
+    for (int y = 0, bad = 0; y < h && !bad; y++) {
+        for (int x = 0; x < w && !bad; x++)
+            bad = !check(Y[y * w + x] == luma(want.at(x, y)), "i420 Y", fmt, w, h, x, y,
+                         Y[y * w + x], luma(want.at(x, y)));
+    }
+    // an odd last row or column is averaged with itself
+    for (int y = 0, bad = 0; y < ch && !bad; y++) {
+        for (int x = 0; x < cw && !bad; x++) {
+            int r = 0, g = 0, b = 0;
+            for (int k = 0; k < 4; k++) {
+                int sx = 2 * x + (k & 1), sy = 2 * y + (k >> 1);
+                uint32_t c = want.at(sx < w ? sx : w - 1, sy < h ? sy : h - 1);
+                r += c >> 16;
+                g += (c >> 8) & 0xFF;
+                b += c & 0xFF;
+            }
+            int i = y * cw + x;
+            bad = !check(U[i] == chroma_u(r, g, b, 4), "i420 U", fmt, w, h, x, y, U[i], chroma_u(r, g, b, 4)) ||
+                  !check(V[i] == chroma_v(r, g, b, 4), "i420 V", fmt, w, h, x, y, V[i], chroma_v(r, g, b, 4));
+        }
+    }
+}
+
+// A lit rectangle off the probe grid in a black frame must be found exactly
+static void test_border(const char *fmt, int format, int w, int h) {
+    int bx = 13, by = 9, bw = w - bx - 21, bh = h - by - 14;
+    fake_ascal_config cfg;
+    fake_ascal_defaults(&cfg);
+    cfg.width = w;
+    cfg.height = h;
+    cfg.format = format;
+    std::vector<unsigned char> image((size_t)w * h * 3, 0);
+    for (int y = by; y < by + bh; y++) {
+        for (int x = bx; x < bx + bw; x++) {
+            uint32_t c = fake_ascal_pixel(&cfg, 0, x, y);
+            if (!c) c = 0xFFFFFF;
+            unsigned char *p = &image[(y * w + x) * 3];
+            p[0] = c >> 16;
+            p[1] = c >> 8;
+            p[2] = c;
+        }
+    }
+    cfg.image = image.data();
+
+    fake_ascal *fa = fake_ascal_create(nullptr, &cfg);
+    if (!fa) {
+        check(false, "border fake", fmt, w, h, 0, 0, 0, 0);
+        return;
+    }
+    shmem_set_source_fd(dup(fake_ascal_fd(fa)), MISTER_SCALER_BASEADDR);
+    mister_scaler *ms = mister_scaler_init();
+    if (!ms) {
+        check(false, "border init", fmt, w, h, 0, 0, 0, 0);
+        fake_ascal_free(fa);
+        return;
+    }
+
+    int x, y, fw, fh;
+    if (check(mister_scaler_find_border(ms, MISTER_BORDER_LEVEL, &x, &y, &fw, &fh) == 0,
+              "border", fmt, w, h, 0, 0, 1, 0)) {
+        check(x == bx && y == by, "border origin", fmt, w, h, x, y, x << 12 | y, bx << 12 | by);
+        check(fw == bw && fh == bh, "border size", fmt, w, h, fw, fh, fw << 12 | fh, bw << 12 | bh);
+    }
+
+    picture want = { w, h, std::vector<uint32_t>((size_t)w * h) };
+    for (int i = 0; i < w * h; i++)
+        want.px[i] = quantize((uint32_t)image[i * 3] << 16 | image[i * 3 + 1] << 8 | image[i * 3 + 2], &ms->pixfmt);
+    if (check(mister_scaler_auto_crop(ms, MISTER_BORDER_LEVEL) == 0, "auto_crop", fmt, w, h, 0, 0, 1, 0) &&
+        check(ms->width == bw && ms->height == bh, "auto_crop size", fmt, w, h, ms->width, ms->height,
+              ms->width << 12 | ms->height, bw << 12 | bh))
+        test_reads(ms, fmt, want, bx, by, " auto_crop");
+
+    mister_scaler_free(ms);
+    fake_ascal_free(fa);
+}
+
+static void test_format(const char *fmt, int w, int h) {
+    int format = mister_pixfmt_parse(fmt);
+    fake_ascal_config cfg;
+    fake_ascal_defaults(&cfg);
+    cfg.width = w;
+    cfg.height = h;
+    cfg.format = format;
+
+    fake_ascal *fa = fake_ascal_create(nullptr, &cfg);
+    if (!fa) {
+        check(false, "fake", fmt, w, h, 0, 0, 0, 0);
+        return;
+    }
+    shmem_set_source_fd(dup(fake_ascal_fd(fa)), MISTER_SCALER_BASEADDR);
+    mister_scaler *ms = mister_scaler_init();
+    if (!ms) {
+        check(false, "init", fmt, w, h, 0, 0, 0, 0);
+        fake_ascal_free(fa);
+        return;
+    }
+    check(ms->width == w && ms->height == h && ms->format == format, "header", fmt, w, h, 0, 0,
+          ms->width << 12 | ms->height, w << 12 | h);
+
+    // the generator is not running, the buffer holds frame 0
+    picture want = { w, h, std::vector<uint32_t>((size_t)w * h) };
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++)
+            want.px[y * w + x] = quantize(fake_ascal_pixel(&cfg, 0, x, y), &ms->pixfmt);
+    }
+    test_reads(ms, fmt, want, 0, 0, "");
+    test_yuv(ms, fmt, want);
+
+    // the same reads from a raw copy, which hashes like the mapping
+    std::vector<unsigned char> copy((size_t)w * h * ms->pixfmt.bpp);
+    uint64_t hash = 0;
+    check(mister_scaler_read_raw(ms, copy.data()) == 0 && mister_scaler_hash(ms, &hash) == 0, "read_raw", fmt,
+          w, h, 0, 0, 1, 0);
+    uint64_t copy_hash = mister_frame_hash(copy.data(), w, h, &ms->pixfmt);
+    check(copy_hash == hash, "frame_hash", fmt, w, h, 0, 0, (int)copy_hash, (int)hash);
+    mister_scaler_set_frame(ms, copy.data());
+    test_reads(ms, fmt, want, 0, 0, " copy");
+    mister_scaler_set_frame(ms, nullptr);
+
+    // a region that starts on odd coordinates
+    int rx = 5, ry = 3, rw = w / 2, rh = h / 2;
+    mister_scaler_set_roi(ms, rx, ry, rw, rh);
+    if (check(ms->width == rw && ms->height == rh, "roi size", fmt, w, h, ms->width, ms->height,
+              ms->width << 12 | ms->height, rw << 12 | rh))
+        test_reads(ms, fmt, want, rx, ry, " roi");
+    // and one past the right and bottom edge, clipped to the frame
+    mister_scaler_set_roi(ms, w - 7, h - 4, 64, 64);
+    if (check(ms->width == 7 && ms->height == 4, "roi clip", fmt, w, h, ms->width, ms->height,
+              ms->width << 12 | ms->height, 7 << 12 | 4))
+        test_reads(ms, fmt, want, w - 7, h - 4, " roi clip");
+    mister_scaler_set_roi(ms, 0, 0, 0, 0);
+    check(ms->width == w && ms->height == h, "roi reset", fmt, w, h, ms->width, ms->height,
+          ms->width << 12 | ms->height, w << 12 | h);
+
+    mister_scaler_free(ms);
+    fake_ascal_free(fa);
+
+    test_border(fmt, format, w, h);
+}
+
+// Interlaced: frame n of the fake is field n & 1, rows 2k + field of a
+// picture twice as high.  Weaving takes the rows of the other parity from the
+// field before, doubling repeats each row, the second field one line lower.
+static void test_interlaced(const char *fmt, int w, int h) {
+    fake_ascal_config cfg;
+    fake_ascal_defaults(&cfg);
+    cfg.width = w;
+    cfg.height = h;
+    cfg.format = mister_pixfmt_parse(fmt);
+    cfg.flags = MISTER_SCALER_INTERLACED;
+
+    fake_ascal *fa = fake_ascal_create(nullptr, &cfg);
+    if (!fa) {
+        check(false, "interlaced fake", fmt, w, h, 0, 0, 0, 0);
+        return;
+    }
+    shmem_set_source_fd(dup(fake_ascal_fd(fa)), MISTER_SCALER_BASEADDR);
+    mister_scaler *ms = mister_scaler_init();
+    if (!ms) {
+        check(false, "interlaced init", fmt, w, h, 0, 0, 0, 0);
+        fake_ascal_free(fa);
+        return;
+    }
+    check(ms->height == h, "field height", fmt, w, h, 0, 0, ms->height, h);
+
+    std::vector<unsigned char> rgb((size_t)w * 2 * h * 3);
+    for (int mode = MISTER_DEINTERLACE_WEAVE; mode <= MISTER_DEINTERLACE_DOUBLE; mode++) {
+        const char *name = mode == MISTER_DEINTERLACE_WEAVE ? "weave" : "double";
+        mister_scaler_set_deinterlace(ms, mode);
+        if (!check(ms->height == 2 * h, name, fmt, w, h, 0, 0, ms->height, 2 * h)) continue;
+        // the first weave has no field before it yet, it waits for one and
+        // doubles; the reads after it each have the field just before
+        mister_scaler_read(ms, rgb.data());
+        for (int k = 0; k < 4; k++) {
+            fake_ascal_step(fa);
+            uint32_t n = fake_ascal_frames(fa) - 1;
+            int field = n & 1;
+            mister_scaler_read(ms, rgb.data());
+            check(ms->field == field, "field bit", fmt, w, h, 0, 0, ms->field, field);
+            // the other parity of a weave comes from the frame before
+            for (int y = 0, bad = 0; y < 2 * h && !bad; y++) {
+                uint32_t from = n;
+                int py = y;
+                if (mode == MISTER_DEINTERLACE_WEAVE) {
+                    if ((y & 1) != field) from = n - 1;
+                } else {
+                    int row = field && y ? (y - 1) >> 1 : y >> 1;
+                    py = 2 * (row < h ? row : h - 1) + field;
+                }
+                for (int x = 0; x < w && !bad; x++) {
+                    const unsigned char *p = &rgb[((size_t)y * w + x) * 3];
+                    uint32_t got = (uint32_t)p[0] << 16 | p[1] << 8 | p[2];
+                    uint32_t c = quantize(fake_ascal_pixel(&cfg, from, x, py), &ms->pixfmt);
+                    bad = !check(got == c, name, fmt, w, 2 * h, x, y, got, c);
+                }
+            }
+        }
+    }
+
+    mister_scaler_free(ms);
+    fake_ascal_free(fa);
+}
+
+// A w x h RGB24 picture of c, or of a vertical bar pattern when c is negative
+static std::vector<unsigned char> rgb24(int w, int h, long c) {
+    std::vector<unsigned char> pic((size_t)w * h * 3);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            uint32_t v = c >= 0 ? (uint32_t)c : (x * 37 + y * 11) % 5 == 0 ? 0xFFFFFF : 0x204080;
+            unsigned char *p = &pic[(y * w + x) * 3];
+            p[0] = v >> 16;
+            p[1] = v >> 8;
+            p[2] = v;
+        }
+    }
+    return pic;
+}
+
+static void test_crt_parse(const char *s, int want, int scale, int scanline, int blur) {
+    mister_crt_opts o;
+    int got = mister_crt_parse(s, &o);
+    if (check(got == want, "crt parse", s, 0, 0, 0, 0, got, want) && !got)
+        check(o.scale == scale && o.scanline == scanline && o.blur == blur, "crt parse values", s, 0, 0,
+              0, 0, o.scale << 16 | o.scanline << 8 | o.blur, scale << 16 | scanline << 8 | blur);
+}
+
+static void test_crt() {
+    test_crt_parse("2", 0, 2, 40, 0);
+    test_crt_parse("3,50", 0, 3, 50, 0);
+    test_crt_parse("3,50,30", 0, 3, 50, 30);
+    test_crt_parse("2x", -1, 0, 0, 0);
+    test_crt_parse("2,abc", -1, 0, 0, 0);
+    test_crt_parse("2,", -1, 0, 0, 0);
+    test_crt_parse("2,40,30,1", -1, 0, 0, 0);
+    test_crt_parse("9", -1, 0, 0, 0);
+    test_crt_parse("2,101", -1, 0, 0, 0);
+
+    const int w = 37, h = 11;
+    const char *name = "rgb24";
+    std::vector<unsigned char> flat = rgb24(w, h, 0x405060), bars = rgb24(w, h, -1), out;
+
+    // no scanlines: blurring a constant picture leaves it as it is
+    for (int s = 1; s <= MISTER_CRT_MAX_SCALE; s++) {
+        mister_crt_opts o = { s, 0, 70 };
+        mister_crt *crt = mister_crt_create(w, h, &o);
+        if (!check(crt != nullptr, "crt create", name, w, h, s, 0, 0, 1)) continue;
+        out.assign((size_t)w * s * h * s * 3, 0);
+        mister_crt_rgb24(crt, flat.data(), out.data(), w * s * 3);
+        for (size_t i = 0, bad = 0; i < out.size() && !bad; i++)
+            bad = !check(out[i] == flat[i % 3], "crt constant", name, w * s, h * s, (int)(i / 3 % (w * s)),
+                         (int)(i / 3 / (w * s)), out[i], flat[i % 3]);
+        mister_crt_free(crt);
+    }
+
+    // the last third of the lines of every row lose the scanline percentage
+    const int s = 3, scanline = 50;
+    mister_crt_opts o = { s, scanline, 0 };
+    mister_crt *crt = mister_crt_create(w, h, &o);
+    if (check(crt != nullptr, "crt create", name, w, h, s, 0, 0, 1)) {
+        out.assign((size_t)w * s * h * s * 3, 0);
+        mister_crt_rgb24(crt, bars.data(), out.data(), w * s * 3);
+        int bright = 256 - scanline * 256 / 100;
+        for (int y = 0, bad = 0; y < h * s && !bad; y++) {
+            for (int x = 0; x < w * s * 3 && !bad; x++) {
+                int v = bars[(y / s * w + x / 3 / s) * 3 + x % 3];
+                int want = y % s == s - 1 ? (v * bright + 128) >> 8 : v;
+                int got = out[(size_t)y * w * s * 3 + x];
+                bad = !check(got == want, "crt scanline", name, w * s, h * s, x / 3, y, got, want);
+            }
+        }
+        mister_crt_free(crt);
+    }
+
+    // at 1x the blur mixes both neighbours into every pixel, the edges repeat
+    for (int blur = 0; blur <= 100; blur += 50) {
+        mister_crt_opts o1 = { 1, 0, blur };
+        crt = mister_crt_create(w, h, &o1);
+        if (!check(crt != nullptr, "crt create", name, w, h, 1, blur, 0, 1)) continue;
+        out.assign((size_t)w * h * 3, 0);
+        mister_crt_rgb24(crt, bars.data(), out.data(), w * 3);
+        int side = blur * 128 / 100 / 2;
+        for (int y = 0, bad = 0; y < h && !bad; y++) {
+            for (int x = 0; x < w * 3 && !bad; x++) {
+                const unsigned char *row = &bars[(size_t)y * w * 3];
+                int l = x >= 3 ? row[x - 3] : row[x], r = x + 3 < w * 3 ? row[x + 3] : row[x];
+                int want = (side * l + (256 - 2 * side) * row[x] + side * r + 128) >> 8;
+                int got = out[(size_t)y * w * 3 + x];
+                bad = !check(got == want, "crt 1x blur", name, w, h, x / 3, y, got, want);
+            }
+        }
+        mister_crt_free(crt);
+    }
+}
+
+// The scaled picture against the source pixels it should come from
+static void test_resample() {
+    const int w = 38, h = 22;
+    const char *modes[] = { "nearest", "area", "bilinear" };
+    std::vector<unsigned char> flat = rgb24(w, h, 0x405060), bars = rgb24(w, h, -1), out;
+
+    // every mode at every size keeps a constant picture constant
+    const int to[][2] = { { w, h }, { 2 * w, 2 * h }, { w / 2, h / 2 }, { 3 * w, h / 3 }, { 17, 51 } };
+    for (int m = 0; m < 3; m++) {
+        for (unsigned t = 0; t < sizeof(to) / sizeof(to[0]); t++) {
+            int dw = to[t][0], dh = to[t][1];
+            mister_resampler *rs = mister_resampler_create(w, h, dw, dh, m);
+            if (!check(rs != nullptr, "resample create", modes[m], dw, dh, 0, 0, 0, 1)) continue;
+            out.assign((size_t)dw * dh * 3, 0);
+            mister_resample_rgb24(rs, flat.data(), out.data());
+            for (size_t i = 0, bad = 0; i < out.size() && !bad; i++)
+                bad = !check(out[i] == flat[i % 3], "resample constant", modes[m], dw, dh,
+                             (int)(i / 3 % dw), (int)(i / 3 / dw), out[i], flat[i % 3]);
+            mister_resampler_free(rs);
+        }
+    }
+
+    // nearest at 2x repeats every pixel twice each way
+    mister_resampler *rs = mister_resampler_create(w, h, 2 * w, 2 * h, MISTER_SCALE_NEAREST);
+    if (check(rs != nullptr, "resample create", "nearest", 2 * w, 2 * h, 0, 0, 0, 1)) {
+        out.assign((size_t)4 * w * h * 3, 0);
+        mister_resample_rgb24(rs, bars.data(), out.data());
+        for (int y = 0, bad = 0; y < 2 * h && !bad; y++) {
+            for (int x = 0; x < 2 * w * 3 && !bad; x++) {
+                int want = bars[(y / 2 * w + x / 6) * 3 + x % 3];
+                int got = out[(size_t)y * 2 * w * 3 + x];
+                bad = !check(got == want, "resample nearest 2x", "nearest", 2 * w, 2 * h, x / 3, y, got, want);
+            }
+        }
+        mister_resampler_free(rs);
+    }
+
+    // area at 2x down is the rounded mean of each 2x2 block
+    rs = mister_resampler_create(w, h, w / 2, h / 2, MISTER_SCALE_AREA);
+    if (check(rs != nullptr, "resample create", "area", w / 2, h / 2, 0, 0, 0, 1)) {
+        out.assign((size_t)(w / 2) * (h / 2) * 3, 0);
+        mister_resample_rgb24(rs, bars.data(), out.data());
+        for (int y = 0, bad = 0; y < h / 2 && !bad; y++) {
+            for (int x = 0; x < w / 2 * 3 && !bad; x++) {
+                const unsigned char *p = &bars[((size_t)2 * y * w + x / 3 * 2) * 3 + x % 3];
+                int want = (p[0] + p[3] + p[w * 3] + p[w * 3 + 3] + 2) >> 2;
+                int got = out[(size_t)y * (w / 2) * 3 + x];
+                bad = !check(got == want, "resample area 2x", "area", w / 2, h / 2, x / 3, y, got, want);
+            }
+        }
+        mister_resampler_free(rs);
+    }
+
+    // area shrinks by at most 60 each way, the other modes by anything
+    rs = mister_resampler_create(1280, 720, 21, 12, MISTER_SCALE_AREA);
+    check(rs != nullptr, "resample area 60", "area", 21, 12, 0, 0, rs != nullptr, 1);
+    mister_resampler_free(rs);
+    rs = mister_resampler_create(1280, 720, 20, 12, MISTER_SCALE_AREA);
+    check(rs == nullptr, "resample area 64", "area", 20, 12, 0, 0, rs != nullptr, 0);
+    mister_resampler_free(rs);
+    rs = mister_resampler_create(1280, 720, 80, 11, MISTER_SCALE_AREA);
+    check(rs == nullptr, "resample area 65", "area", 80, 11, 0, 0, rs != nullptr, 0);
+    mister_resampler_free(rs);
+    rs = mister_resampler_create(1280, 720, 20, 11, MISTER_SCALE_BILINEAR);
+    check(rs != nullptr, "resample bilinear 64", "bilinear", 20, 11, 0, 0, rs != nullptr, 1);
+    mister_resampler_free(rs);
+}
+
+static void collect_text(void *ctx, const char *key, const char *value) {
+    std::vector<std::string> *got = (std::vector<std::string> *)ctx;
+    got->push_back(std::string(key) + "=" + value);
+}
+
+// Text put into an encoded PNG comes back out of its head, tEXt for ASCII and
+// iTXt for the rest, and the picture after it is untouched
+static void test_pngtext() {
+    const int w = 21, h = 13;
+    const char *name = "png";
+    std::vector<unsigned char> pic = rgb24(w, h, -1);
+    unsigned char *png = nullptr;
+    size_t size = 0;
+    if (!check(!lodepng_encode24(&png, &size, pic.data(), w, h), "png encode", name, w, h, 0, 0, 0, 0))
+        return;
+
+    const char *keys[] = { "Software", "Title", "Comment" };
+    const char *values[] = { "screensht", "Mot\xc3\xb6rhead \xe2\x80\x94 Ac\xc3\xa9", "" };
+    const char *types[] = { "tEXt", "iTXt", "tEXt" };
+    const int n = 3;
+    unsigned error = pngtext_insert(&png, &size, keys, values, n);
+    if (!check(!error, "pngtext insert", name, w, h, 0, 0, error, 0)) {
+        free(png);
+        return;
+    }
+
+    // IHDR first, then the text in order, all of it before the first IDAT
+    const unsigned char *end = png + size;
+    unsigned char *chunk = png + 8;
+    char type[5];
+    lodepng_chunk_type(type, chunk);
+    check(!strcmp(type, "IHDR"), "pngtext IHDR first", type, w, h, 0, 0, 0, 0);
+    int texts = 0, before_idat = 0;
+    bool idat = false;
+    for (; chunk + 12 <= end; chunk = lodepng_chunk_next(chunk)) {
+        lodepng_chunk_type(type, chunk);
+        if (!strcmp(type, "IDAT")) idat = true;
+        if (!strcmp(type, "tEXt") || !strcmp(type, "iTXt")) {
+            if (texts < n)
+                check(!strcmp(type, types[texts]), "pngtext chunk type", type, w, h, texts, 0, 0, 0);
+            texts++;
+            before_idat += !idat;
+        }
+        if (!strcmp(type, "IEND")) break;
+    }
+    check(texts == n && before_idat == n, "pngtext before IDAT", name, w, h, 0, 0, before_idat, n);
+
+    std::vector<std::string> got;
+    unsigned pw = 0, ph = 0;
+    long r = pngtext_scan(png, size, &pw, &ph, collect_text, &got);
+    check(r == 0, "pngtext scan", name, w, h, 0, 0, (uint32_t)r, 0);
+    check((int)pw == w && (int)ph == h, "pngtext size", name, w, h, 0, 0, pw << 16 | ph, w << 16 | h);
+    if (check((int)got.size() == n, "pngtext count", name, w, h, 0, 0, (uint32_t)got.size(), n)) {
+        for (int i = 0; i < n; i++)
+            check(got[i] == std::string(keys[i]) + "=" + values[i], "pngtext value", got[i].c_str(), w, h,
+                  i, 0, 0, 0);
+    }
+
+    // cut short inside the text, the scan asks for more and finds nothing yet
+    got.clear();
+    r = pngtext_scan(png, 60, &pw, &ph, collect_text, &got);
+    check(r > 60 && got.empty(), "pngtext short", name, w, h, 0, 0, (uint32_t)r, 61);
+
+    unsigned char *back = nullptr;
+    error = lodepng_decode24(&back, &pw, &ph, png, size);
+    if (check(!error && (int)pw == w && (int)ph == h, "pngtext decode", name, w, h, 0, 0, error, 0))
+        check(!memcmp(back, pic.data(), pic.size()), "pngtext picture", name, w, h, 0, 0, 0, 0);
+    free(back);
+    free(png);
+}
+
+static uint32_t get32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// One frame of an APNG as it is stored, the zlib data of its IDAT or fdATs
+struct apng_part {
+    uint32_t w, h, x, y, delay;
+    std::vector<unsigned char> data;
+};
+
+// Splits an APNG into its frames and the IHDR and PLTE they share, false when
+// the chunks are not in the order a reader needs them
+static bool apng_parts(const unsigned char *png, size_t size, uint32_t *frames, unsigned char *ihdr,
+                       std::vector<unsigned char> *plte, std::vector<apng_part> *parts) {
+    const unsigned char *end = png + size;
+    unsigned char *chunk = (unsigned char *)png + 8;
+    uint32_t seq = 0;
+    bool idat = false, iend = false;
+    *frames = 0;
+    for (; chunk + 12 <= end && !iend; chunk = lodepng_chunk_next(chunk)) {
+        unsigned len = lodepng_chunk_length(chunk);
+        const unsigned char *data = lodepng_chunk_data_const(chunk);
+        if (lodepng_chunk_check_crc(chunk)) return false;
+        if (lodepng_chunk_type_equals(chunk, "IHDR")) {
+            std::memcpy(ihdr, data, 13);
+        } else if (lodepng_chunk_type_equals(chunk, "acTL")) {
+            *frames = get32(data);
+        } else if (lodepng_chunk_type_equals(chunk, "PLTE")) {
+            // one palette for every frame, ahead of all the picture data
+            if (!plte->empty() || !parts->empty()) return false;
+            plte->assign(data, data + len);
+        } else if (lodepng_chunk_type_equals(chunk, "fcTL")) {
+            if (get32(data) != seq++) return false;
+            apng_part part = { get32(data + 4), get32(data + 8), get32(data + 12), get32(data + 16),
+                               (uint32_t)(data[20] << 8 | data[21]), {} };
+            if ((data[22] << 8 | data[23]) != 1000 || data[24] || data[25]) return false;
+            parts->push_back(part);
+        } else if (lodepng_chunk_type_equals(chunk, "IDAT")) {
+            if (parts->size() != 1 || idat) return false;
+            idat = true;
+            parts->back().data.assign(data, data + len);
+        } else if (lodepng_chunk_type_equals(chunk, "fdAT")) {
+            if (parts->size() < 2 || get32(data) != seq++) return false;
+            parts->back().data.insert(parts->back().data.end(), data + 4, data + len);
+        }
+        iend = lodepng_chunk_type_equals(chunk, "IEND");
+    }
+    return iend && idat;
+}
+
+// The rectangle of a part as RGB24, through a PNG of its own
+static bool apng_decode_part(const unsigned char *ihdr, const std::vector<unsigned char> &plte,
+                             const apng_part &part, std::vector<unsigned char> *rgb) {
+    unsigned char *png = (unsigned char *)std::malloc(8);
+    static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    std::memcpy(png, signature, 8);
+    size_t size = 8;
+    unsigned char head[13];
+    std::memcpy(head, ihdr, 13);
+    for (int i = 0; i < 4; i++) {
+        head[i] = part.w >> (24 - 8 * i);
+        head[4 + i] = part.h >> (24 - 8 * i);
+    }
+    unsigned error = lodepng_chunk_create(&png, &size, 13, "IHDR", head);
+    if (!error && !plte.empty()) error = lodepng_chunk_create(&png, &size, plte.size(), "PLTE", plte.data());
+    if (!error) error = lodepng_chunk_create(&png, &size, part.data.size(), "IDAT", part.data.data());
+    if (!error) error = lodepng_chunk_create(&png, &size, 0, "IEND", nullptr);
+    unsigned char *out = nullptr;
+    unsigned w = 0, h = 0;
+    if (!error) error = lodepng_decode24(&out, &w, &h, png, size);
+    if (!error) rgb->assign(out, out + (size_t)w * h * 3);
+    std::free(out);
+    std::free(png);
+    return !error && w == part.w && h == part.h;
+}
+
+// A clip read from a fake that holds every picture for hold frames, 20 ms
+// apart: one APNG frame per picture, stored as the rectangle that changed,
+// shown for as long as the picture was
+static void test_apng(int hold, int count) {
+    fake_ascal_config cfg;
+    fake_ascal_defaults(&cfg);
+    cfg.width = 96;
+    cfg.height = 64;
+    cfg.format = mister_pixfmt_parse("RGB888");
+    cfg.hold = hold;
+    const int w = cfg.width, h = cfg.height;
+    char name[32];
+    std::snprintf(name, sizeof(name), "apng -H %d", hold);
+
+    fake_ascal *fa = fake_ascal_create(nullptr, &cfg);
+    if (!check(fa != nullptr, "apng fake", name, w, h, 0, 0, 0, 1)) return;
+    shmem_set_source_fd(dup(fake_ascal_fd(fa)), MISTER_SCALER_BASEADDR);
+    mister_scaler *ms = mister_scaler_init();
+    if (!check(ms != nullptr, "apng init", name, w, h, 0, 0, 0, 1)) {
+        fake_ascal_free(fa);
+        return;
+    }
+
+    // the pictures that change, when and for how long, worked out here
+    apng_writer *aw = apng_create(w, h);
+    std::vector<std::vector<unsigned char>> pics;
+    std::vector<uint32_t> delays;
+    std::vector<unsigned char> rgb((size_t)w * h * 3);
+    for (int i = 0; i < count; i++) {
+        fake_ascal_step(fa);
+        mister_scaler_read(ms, rgb.data());
+        apng_add_frame(aw, rgb.data(), 1000 + 20 * i);
+        if (pics.empty() || rgb != pics.back()) {
+            pics.push_back(rgb);
+            delays.push_back(0);
+        }
+        delays.back() += 20;
+    }
+    mister_scaler_free(ms);
+    fake_ascal_free(fa);
+
+    check(apng_frames(aw) == pics.size(), "apng frames", name, w, h, 0, 0, apng_frames(aw), pics.size());
+    check(apng_paletted(aw), "apng paletted", name, w, h, 0, 0, apng_paletted(aw), 1);
+    unsigned char *png = nullptr;
+    size_t size = 0;
+    unsigned error = apng_encode(aw, &png, &size);
+    apng_free(aw);
+    if (!check(!error, "apng encode", name, w, h, 0, 0, error, 0)) return;
+
+    uint32_t frames;
+    unsigned char ihdr[13];
+    std::vector<unsigned char> plte;
+    std::vector<apng_part> parts;
+    bool ok = apng_parts(png, size, &frames, ihdr, &plte, &parts);
+    if (check(ok, "apng chunks", name, w, h, 0, 0, ok, 1) &&
+        check(frames == pics.size() && parts.size() == pics.size(), "apng acTL", name, w, h, 0, 0, frames,
+              pics.size()) &&
+        check(ihdr[9] == 3 && !plte.empty(), "apng PLTE", name, w, h, 0, 0, ihdr[9], 3)) {
+        // every frame pasted over the one before gives the picture back, its
+        // rectangle is just what differs from the picture before
+        std::vector<unsigned char> canvas((size_t)w * h * 3), rect;
+        for (size_t i = 0; i < parts.size(); i++) {
+            const apng_part &part = parts[i];
+            check(part.delay == delays[i], "apng delay", name, w, h, (int)i, 0, part.delay, delays[i]);
+            int x0 = w, y0 = h, x1 = 0, y1 = 0;
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    size_t at = ((size_t)y * w + x) * 3;
+                    if (i && !std::memcmp(&pics[i][at], &pics[i - 1][at], 3)) continue;
+                    x0 = std::min(x0, x), y0 = std::min(y0, y);
+                    x1 = std::max(x1, x + 1), y1 = std::max(y1, y + 1);
+                }
+            }
+            if (!check((int)part.x == x0 && (int)part.y == y0 && (int)(part.x + part.w) == x1 &&
+                           (int)(part.y + part.h) == y1,
+                       "apng rectangle", name, w, h, part.x, part.y, part.w << 16 | part.h,
+                       (x1 - x0) << 16 | (y1 - y0)) ||
+                !check(apng_decode_part(ihdr, plte, part, &rect), "apng decode", name, w, h, (int)i, 0, 0, 0))
+                continue;
+            for (uint32_t y = 0; y < part.h; y++)
+                std::memcpy(&canvas[((size_t)(part.y + y) * w + part.x) * 3], &rect[(size_t)y * part.w * 3],
+                            part.w * 3);
+            check(canvas == pics[i], "apng picture", name, w, h, (int)i, 0, 0, 0);
+        }
+    }
+    std::free(png);
+}
+
+int main() {
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (unsigned f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+            test_format(formats[f], sizes[s][0], sizes[s][1]);
+        test_interlaced("RGB888", sizes[s][0], sizes[s][1] / 2);
+        test_interlaced("RGB565", sizes[s][0], sizes[s][1] / 2);
+    }
+    test_crt();
+    test_resample();
+    test_pngtext();
+    test_apng(3, 12);
+    test_apng(1, 5);
+    // nothing changes: one frame that lasts the whole clip
+    test_apng(1000, 9);
+    std::printf("%d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,190 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+#include "fake_ascal.h"
+
+// Checks the timing of a recording of mister_fake -S, e.g.
+//   mister_fake -S -j 2000 -p 120:50 /dev/shm/ascal &
+//   MISTER_MEM=/dev/shm/ascal encode_video - y4m 20 | mister_verify -
+// Every frame carries the number of the core frame it was taken from, so the
+// order, the repeated pictures and the frames that never made it into the
+// file can be counted, and a frame shown before its time (a lost slot in a
+// constant frame rate file) is caught.
+
+struct input {
+    FILE *f;
+    bool y4m;
+    int width, height;
+    size_t chroma;      // bytes of the other planes after Y
+    std::vector<uint8_t> rgb, skip;
+};
+
+static bool read_line(FILE *f, std::string &line) {
+    line.clear();
+    int c;
+    while ((c = std::fgetc(f)) != EOF && c != '\n') line += (char)c;
+    return c == '\n';
+}
+
+static bool open_y4m(input *in) {
+    std::string line;
+    if (!read_line(in->f, line) || line.compare(0, 10, "YUV4MPEG2 ")) {
+        std::fprintf(stderr, "not a YUV4MPEG2 stream, use -s WxH for raw RGB24\n");
+        return false;
+    }
+    std::string cs = "420";
+    size_t pos = 0;
+    while ((pos = line.find(' ', pos)) != std::string::npos) {
+        pos++;
+        if (line[pos] == 'W') in->width = std::atoi(&line[pos + 1]);
+        else if (line[pos] == 'H') in->height = std::atoi(&line[pos + 1]);
+        else if (line[pos] == 'C') cs = line.substr(pos + 1, line.find(' ', pos) - pos - 1);
+    }
+    size_t cw = (in->width + 1) / 2, ch = (in->height + 1) / 2;
+    if (!cs.compare(0, 3, "444")) in->chroma = 2 * (size_t)in->width * in->height;
+    else if (!cs.compare(0, 3, "422")) in->chroma = 2 * cw * in->height;
+    else if (!cs.compare(0, 3, "420")) in->chroma = 2 * cw * ch;
+    else if (!cs.compare(0, 4, "mono")) in->chroma = 0;
+    else {
+        std::fprintf(stderr, "unsupported colour space C%s\n", cs.c_str());
+        return false;
+    }
+    return in->width > 0 && in->height > 0;
+}
+
+// Luma of the next frame, false at the end of the input
+static bool read_frame(input *in, std::vector<uint8_t> &luma) {
+    size_t n = (size_t)in->width * in->height;
+    luma.resize(n);
+    if (in->y4m) {
+        std::string line;
+        if (!read_line(in->f, line)) return false;
+        if (line.compare(0, 5, "FRAME")) {
+            std::fprintf(stderr, "lost sync in the Y4M stream\n");
+            return false;
+        }
+        in->skip.resize(in->chroma);
+        return std::fread(luma.data(), 1, n, in->f) == n &&
+               std::fread(in->skip.data(), 1, in->chroma, in->f) == in->chroma;
+    }
+    in->rgb.resize(n * 3);
+    if (std::fread(in->rgb.data(), 1, n * 3, in->f) != n * 3) return false;
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t *p = &in->rgb[i * 3];
+        luma[i] = (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+    }
+    return true;
+}
+
+static void usage(const char *prog) {
+    std::fprintf(stderr,
+        "Usage: %s [options] <file | ->\n"
+        "  -s WxH    the input is raw RGB24 of this size, not YUV4MPEG2\n"
+        "  -n N      the recording took every Nth frame of the core (1)\n"
+        "  -m N      fail when more than N frames are missing\n"
+        "  -v        print the stamp of every frame\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    input in;
+    in.y4m = true;
+    in.width = in.height = 0;
+    in.chroma = 0;
+    int step = 1;
+    long max_missing = -1;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:m:vh")) != -1) {
+        switch (opt) {
+            case 's':
+                if (std::sscanf(optarg, "%dx%d", &in.width, &in.height) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                in.y4m = false;
+                break;
+            case 'n': step = std::atoi(optarg); break;
+            case 'm': max_missing = std::atol(optarg); break;
+            case 'v': verbose = true; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || step < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *name = argv[optind];
+    in.f = std::strcmp(name, "-") ? std::fopen(name, "rb") : stdin;
+    if (!in.f) {
+        std::fprintf(stderr, "unable to open %s\n", name);
+        return 1;
+    }
+    if (in.y4m && !open_y4m(&in)) return 1;
+
+    std::vector<uint8_t> luma;
+    long frames = 0, stamped = 0, unreadable = 0, repeated = 0, missing = 0;
+    long out_of_order = 0, ahead = 0;
+    int64_t max_ahead = 0, max_behind = 0;
+    uint32_t first = 0, prev = 0;
+    long first_index = 0;
+
+    while (read_frame(&in, luma)) {
+        long k = frames++;
+        uint32_t s;
+        if (fake_ascal_read_stamp(luma.data(), in.width, in.width, in.height, &s)) {
+            unreadable++;
+            if (verbose) std::printf("%ld: no stamp\n", k);
+            continue;
+        }
+        if (!stamped++) {
+            first = prev = s;
+            first_index = k;
+        }
+
+        // where the frame should be in a constant frame rate file
+        int64_t due = first + (int64_t)(k - first_index) * step;
+        int64_t late = due - (int64_t)s;
+        const char *what = "";
+        if (s < prev) {
+            out_of_order++;
+            what = " out of order";
+        } else if (s == prev && k != first_index) {
+            repeated++;
+            what = " repeated";
+        } else if (s > prev) {
+            long gap = (long)((s - prev) / step) - 1;
+            if (gap > 0) missing += gap;
+        }
+        if (late < 0) {
+            ahead++;
+            if (-late > max_ahead) max_ahead = -late;
+            what = " ahead of its slot";
+        } else if (late > max_behind) {
+            max_behind = late;
+        }
+        if (verbose) std::printf("%ld: frame %u%s\n", k, s, what);
+        prev = s;
+    }
+
+    std::fprintf(stderr,
+        "%ld frames, core frames %u to %u, %ld repeated, %ld missing, %ld out of order, "
+        "%ld ahead of their slot (by up to %lld), up to %lld behind, %ld without a stamp\n",
+        frames, first, prev, repeated, missing, out_of_order, ahead,
+        (long long)max_ahead, (long long)max_behind, unreadable);
+
+    if (in.f != stdin) std::fclose(in.f);
+    bool ok = stamped && !unreadable && !out_of_order && !ahead &&
+              (max_missing < 0 || missing <= max_missing);
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
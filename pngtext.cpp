@@ -0,0 +1,114 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "lodepng.h"
+#include "pngtext.h"
+
+static bool ascii(const char *s) {
+    for (; *s; s++) {
+        if ((unsigned char)*s >= 0x80) return false;
+    }
+    return true;
+}
+
+unsigned pngtext_insert(unsigned char **png, size_t *size, const char *const *keys,
+                        const char *const *values, int n) {
+    if (*size < 8) return 28;
+    unsigned char *idat = lodepng_chunk_find(*png + 8, *png + *size, "IDAT");
+    if (!idat) return 28;
+
+    // the new chunks on their own, then spliced in before the pixels
+    unsigned char *chunks = NULL;
+    size_t chunks_size = 0;
+    unsigned error = 0;
+    std::vector<unsigned char> data;
+    for (int i = 0; i < n && !error; i++) {
+        size_t klen = strlen(keys[i]);
+        if (klen > 79) error = 66;
+        else if (klen < 1) error = 67;
+        if (error) break;
+        bool utf8 = !ascii(values[i]);
+        data.assign(keys[i], keys[i] + klen + 1);
+        if (utf8) {
+            // not compressed, no language tag, no translated keyword
+            static const unsigned char itxt[] = { 0, 0, 0, 0 };
+            data.insert(data.end(), itxt, itxt + sizeof(itxt));
+        }
+        data.insert(data.end(), values[i], values[i] + strlen(values[i]));
+        error = lodepng_chunk_create(&chunks, &chunks_size, (unsigned)data.size(),
+                                     utf8 ? "iTXt" : "tEXt", data.data());
+    }
+    if (!error && chunks_size) {
+        size_t head = idat - *png;
+        unsigned char *out = (unsigned char *)malloc(*size + chunks_size);
+        if (!out) {
+            error = 83;
+        } else {
+            memcpy(out, *png, head);
+            memcpy(out + head, chunks, chunks_size);
+            memcpy(out + head + chunks_size, *png + head, *size - head);
+            free(*png);
+            *png = out;
+            *size += chunks_size;
+        }
+    }
+    free(chunks);
+    return error;
+}
+
+long pngtext_scan(const unsigned char *png, size_t size, unsigned *width, unsigned *height,
+                  pngtext_fn text, void *ctx) {
+    // signature and IHDR
+    const size_t ihdr_end = 8 + 12 + 13;
+    if (size < ihdr_end) return ihdr_end;
+    LodePNGState state;
+    lodepng_state_init(&state);
+    unsigned error = lodepng_inspect(width, height, &state, png, size);
+    lodepng_state_cleanup(&state);
+    if (error) return -1;
+
+    const unsigned char *end = png + size;
+    const unsigned char *chunk = png + ihdr_end;
+    std::string key, value;
+    for (;;) {
+        if ((size_t)(end - chunk) < 8) return (long)(chunk - png) + 12;
+        unsigned len = lodepng_chunk_length(chunk);
+        if (len > 0x7FFFFFFFu) return -1;
+        // the picture starts here, or there is none
+        if (lodepng_chunk_type_equals(chunk, "IDAT") || lodepng_chunk_type_equals(chunk, "IEND"))
+            return 0;
+        size_t total = (size_t)len + 12;
+        if ((size_t)(end - chunk) < total) return (long)((chunk - png) + total);
+
+        bool is_text = lodepng_chunk_type_equals(chunk, "tEXt");
+        bool is_itext = lodepng_chunk_type_equals(chunk, "iTXt");
+        if (is_text || is_itext) {
+            if (lodepng_chunk_check_crc(chunk)) return -1;
+            const char *data = (const char *)lodepng_chunk_data_const(chunk);
+            const char *data_end = data + len;
+            const char *nul = (const char *)memchr(data, 0, len);
+            if (!nul) return -1;
+            key.assign(data, nul);
+            const char *p = nul + 1;
+            bool plain = true;
+            if (is_itext) {
+                // compression flag and method, then the language tag and
+                // translated keyword, each up to a NUL
+                plain = data_end - p >= 2 && p[0] == 0;
+                p += 2;
+                for (int k = 0; k < 2 && plain; k++) {
+                    const char *z = p < data_end ? (const char *)memchr(p, 0, data_end - p) : NULL;
+                    if (!z) plain = false;
+                    else p = z + 1;
+                }
+            }
+            if (plain) {
+                value.assign(p, data_end);
+                text(ctx, key.c_str(), value.c_str());
+            }
+        }
+        chunk = lodepng_chunk_next_const(chunk);
+    }
+}
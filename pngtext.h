@@ -0,0 +1,28 @@
+/*
+Text chunks added to an already encoded PNG, and read back from the head of
+one.  The chunks go in right before the first IDAT, so the picture is never
+encoded again to add them and a reader learns everything from the first few
+hundred bytes of the file without inflating anything.
+*/
+
+#ifndef PNGTEXT_H
+#define PNGTEXT_H
+
+#include <stddef.h>
+
+// Inserts a tEXt chunk for every key and value, iTXt when the value is not
+// ASCII (taken as UTF-8).  png is reallocated.  Returns a lodepng error code.
+unsigned pngtext_insert(unsigned char **png, size_t *size, const char *const *keys,
+                        const char *const *values, int n);
+
+typedef void (*pngtext_fn)(void *ctx, const char *key, const char *value);
+
+// Walks the chunks of the first size bytes of a PNG up to the first IDAT:
+// width and height come from IHDR, text(ctx, key, value) is called for every
+// uncompressed tEXt and iTXt.  Returns 0 when it got to IDAT, -1 when this is
+// not a PNG or a chunk is broken, or the number of bytes of the file it needs
+// when a chunk goes past size.
+long pngtext_scan(const unsigned char *png, size_t size, unsigned *width, unsigned *height,
+                  pngtext_fn text, void *ctx);
+
+#endif
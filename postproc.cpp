@@ -0,0 +1,153 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "postproc.h"
+#include "trace.h"
+
+#ifdef HAVE_IMLIB2
+
+#include <Imlib2.h>
+
+struct mister_postproc {
+    Imlib_Font font;            // NULL when there is no text
+    Imlib_Image out;            // scaled picture, kept while the size stays
+    int out_w, out_h;
+    unsigned char *rgb;         // the result
+    size_t rgb_size;
+};
+
+mister_postproc *mister_postproc_create(const char *font_dir, const char *font)
+{
+    mister_postproc *pp = (mister_postproc *)calloc(1, sizeof(mister_postproc));
+    if (!pp) return NULL;
+    // the picture is drawn as is, never dithered for a display
+    imlib_context_set_dither(0);
+    if (font) {
+        if (font_dir) imlib_add_path_to_font_path(font_dir);
+        pp->font = imlib_load_font(font);
+        if (!pp->font) {
+            fprintf(stderr, "unable to load the font %s from %s\n", font, font_dir ? font_dir : "the font path");
+            free(pp);
+            return NULL;
+        }
+    }
+    return pp;
+}
+
+void mister_postproc_free(mister_postproc *pp)
+{
+    if (!pp) return;
+    if (pp->font) {
+        imlib_context_set_font(pp->font);
+        imlib_free_font();
+    }
+    if (pp->out) {
+        imlib_context_set_image(pp->out);
+        imlib_free_image();
+    }
+    free(pp->rgb);
+    free(pp);
+}
+
+// A dark box behind the text keeps it readable on any picture
+static void draw_text(mister_postproc *pp, int w, int h, const char *text)
+{
+    int tw = 0, th = 0;
+    imlib_context_set_font(pp->font);
+    imlib_get_text_size(text, &tw, &th);
+    int x = 2, y = h - th - 2;
+    imlib_context_set_blend(1);
+    imlib_context_set_color(0, 0, 0, 160);
+    imlib_image_fill_rectangle(0, y - 1, tw + 4 < w ? tw + 4 : w, th + 3);
+    imlib_context_set_color(255, 255, 255, 255);
+    imlib_text_draw(x, y, text);
+}
+
+const unsigned char *mister_postproc_run(mister_postproc *pp, unsigned char *bgra, int w, int h,
+                                         const mister_postproc_opts *opts, int *out_w, int *out_h)
+{
+    trace_scope trace("postproc");
+    int cx = opts->crop_x, cy = opts->crop_y;
+    int cw = opts->crop_w ? opts->crop_w : w - cx;
+    int ch = opts->crop_h ? opts->crop_h : h - cy;
+    if (cx < 0 || cy < 0 || cw <= 0 || ch <= 0 || cx + cw > w || cy + ch > h) return NULL;
+    int ow = opts->scale_w ? opts->scale_w : cw;
+    int oh = opts->scale_h ? opts->scale_h : ch;
+
+    Imlib_Image src = imlib_create_image_using_data(w, h, (DATA32 *)bgra);
+    if (!src) return NULL;
+
+    // the capture itself is the image unless it changes size
+    Imlib_Image target = src;
+    if (cx || cy || cw != w || ch != h || ow != w || oh != h) {
+        if (pp->out && (pp->out_w != ow || pp->out_h != oh)) {
+            imlib_context_set_image(pp->out);
+            imlib_free_image();
+            pp->out = NULL;
+        }
+        if (!pp->out) {
+            pp->out = imlib_create_image(ow, oh);
+            pp->out_w = ow;
+            pp->out_h = oh;
+        }
+        if (!pp->out) {
+            imlib_context_set_image(src);
+            imlib_free_image();
+            return NULL;
+        }
+        imlib_context_set_image(pp->out);
+        imlib_context_set_blend(0);
+        imlib_context_set_anti_alias(opts->smooth);
+        imlib_blend_image_onto_image(src, 0, cx, cy, cw, ch, 0, 0, ow, oh);
+        target = pp->out;
+    }
+
+    imlib_context_set_image(target);
+    if (opts->text && *opts->text && pp->font)
+        draw_text(pp, ow, oh, opts->text);
+
+    size_t size = (size_t)ow * oh * 3;
+    if (size > pp->rgb_size) {
+        free(pp->rgb);
+        pp->rgb = (unsigned char *)malloc(size);
+        pp->rgb_size = pp->rgb ? size : 0;
+    }
+    if (pp->rgb) {
+        const DATA32 *argb = imlib_image_get_data_for_reading_only();
+        unsigned char *dst = pp->rgb;
+        for (size_t i = 0; i < (size_t)ow * oh; i++) {
+            *dst++ = argb[i] >> 16;
+            *dst++ = argb[i] >> 8;
+            *dst++ = argb[i];
+        }
+    }
+
+    // the capture buffer stays with the caller
+    imlib_context_set_image(src);
+    imlib_free_image();
+    *out_w = ow;
+    *out_h = oh;
+    return pp->rgb;
+}
+
+#else
+
+mister_postproc *mister_postproc_create(const char *, const char *)
+{
+    fprintf(stderr, "built without Imlib2, make IMLIB2=1 for post-processing\n");
+    return NULL;
+}
+
+void mister_postproc_free(mister_postproc *)
+{
+}
+
+const unsigned char *mister_postproc_run(mister_postproc *, unsigned char *, int, int,
+                                         const mister_postproc_opts *, int *, int *)
+{
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,33 @@
+/*
+Optional post-processing of screenshots with the Imlib2 in lib/imlib2:
+crop, scale and a line of text drawn over the picture.  It works on the
+BGRA picture mister_scaler_read_32 writes, wrapped in place, and keeps the
+font and the output image between calls, so a long running screensht
+(--daemon) pays for loading them once.  Without HAVE_IMLIB2 (make IMLIB2=1)
+mister_postproc_create returns NULL.
+*/
+
+#ifndef POSTPROC_H
+#define POSTPROC_H
+
+typedef struct {
+   int crop_x, crop_y;
+   int crop_w, crop_h;   // 0 = the whole picture
+   int scale_w, scale_h; // 0 = the size of the crop
+   int smooth;           // anti-aliased scaling instead of pixel replication
+   const char *text;     // drawn at the bottom left, NULL for none
+} mister_postproc_opts;
+
+struct mister_postproc;
+
+// font is "name/size" of a TrueType font found in font_dir, e.g. "DejaVuSans/10",
+// NULL when no text will be drawn
+mister_postproc *mister_postproc_create(const char *font_dir, const char *font);
+void mister_postproc_free(mister_postproc *pp);
+
+// Runs the steps on a w x h BGRA picture, which may be drawn on.  Returns
+// the result as RGB24, valid until the next call, or NULL on failure.
+const unsigned char *mister_postproc_run(mister_postproc *pp, unsigned char *bgra, int w, int h,
+                                         const mister_postproc_opts *opts, int *out_w, int *out_h);
+
+#endif
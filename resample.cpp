@@ -0,0 +1,269 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "resample.h"
+
+#define WEIGHT_BITS 14
+#define WEIGHT_ONE  (1 << WEIGHT_BITS)
+// fraction bits the horizontal pass keeps for the vertical one
+#define MID_BITS    8
+
+// Source span and weights of every output index along one axis
+typedef struct {
+    int *start;
+    int *count;
+    uint16_t *weight;   // max_count per output index, summing to WEIGHT_ONE
+    int max_count;
+} taps;
+
+struct mister_resampler {
+    int src_w, src_h, dst_w, dst_h;
+    int mode;
+    taps h, v;
+    unsigned char *row;     // a converted source row
+    // the last v.max_count source rows scaled horizontally, enough for any
+    // output row, with MID_BITS fraction bits
+    uint16_t *ring;
+    int *tag;               // source row held by each slot, -1 when empty
+    uint32_t *acc;          // vertical sums of one output row
+};
+
+static const char *scale_names[] = { "nearest", "area", "bilinear" };
+
+int mister_scale_parse(const char *name)
+{
+    for (int i = 0; i < 3; i++) {
+        if (!strcasecmp(name, scale_names[i])) return i;
+    }
+    return -1;
+}
+
+const char *mister_scale_name(int mode)
+{
+    return mode >= 0 && mode < 3 ? scale_names[mode] : "unknown";
+}
+
+static bool make_taps(taps *t, int n, int m, int mode)
+{
+    double scale = (double)n / m;
+    t->max_count = mode == MISTER_SCALE_NEAREST ? 1 :
+                   mode == MISTER_SCALE_BILINEAR ? 2 : (int)ceil(scale) + 1;
+    t->start = (int *)calloc(m, sizeof(int));
+    t->count = (int *)calloc(m, sizeof(int));
+    t->weight = (uint16_t *)calloc((size_t)m * t->max_count, sizeof(uint16_t));
+    if (!t->start || !t->count || !t->weight) return false;
+
+    double w[64];
+    for (int i = 0; i < m; i++) {
+        int s, c;
+        if (mode == MISTER_SCALE_NEAREST) {
+            s = (int)(((2 * (int64_t)i + 1) * n) / (2 * (int64_t)m));
+            c = 1;
+            w[0] = 1;
+        } else if (mode == MISTER_SCALE_BILINEAR) {
+            // always two taps, the last pixel is the second one of the pair
+            double x = (i + 0.5) * scale - 0.5;
+            if (x < 0) x = 0;
+            if (x > n - 1) x = n - 1;
+            s = (int)x;
+            if (s > n - 2) s = n > 1 ? n - 2 : 0;
+            c = n > 1 ? 2 : 1;
+            w[1] = x - s;
+            w[0] = 1 - w[1];
+        } else {
+            // overlap of [a, b) with every source pixel
+            double a = i * scale, b = (i + 1) * scale;
+            s = (int)a;
+            int e = (int)ceil(b);
+            if (e > n) e = n;
+            c = e - s;
+            if (c > t->max_count) c = t->max_count;
+            for (int k = 0; k < c; k++) {
+                double lo = a > s + k ? a : s + k;
+                double hi = b < s + k + 1 ? b : s + k + 1;
+                w[k] = (hi - lo) / scale;
+            }
+        }
+
+        // round to fixed point, the largest tap takes the rounding error
+        uint16_t *q = &t->weight[(size_t)i * t->max_count];
+        int sum = 0, largest = 0;
+        for (int k = 0; k < c; k++) {
+            q[k] = (uint16_t)lround(w[k] * WEIGHT_ONE);
+            sum += q[k];
+            if (q[k] > q[largest]) largest = k;
+        }
+        q[largest] += WEIGHT_ONE - sum;
+        t->start[i] = s;
+        t->count[i] = c;
+    }
+    return true;
+}
+
+static void free_taps(taps *t)
+{
+    free(t->start);
+    free(t->count);
+    free(t->weight);
+}
+
+mister_resampler *mister_resampler_create(int src_w, int src_h, int dst_w, int dst_h, int mode)
+{
+    if (src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0 || mode < 0 || mode > 2)
+        return NULL;
+    // area taps are on the stack in make_taps
+    if (mode == MISTER_SCALE_AREA && (src_w / dst_w > 60 || src_h / dst_h > 60))
+        return NULL;
+
+    mister_resampler *rs = (mister_resampler *)calloc(1, sizeof(mister_resampler));
+    if (!rs) return NULL;
+    rs->src_w = src_w;
+    rs->src_h = src_h;
+    rs->dst_w = dst_w;
+    rs->dst_h = dst_h;
+    rs->mode = mode;
+
+    bool ok = make_taps(&rs->h, src_w, dst_w, mode) && make_taps(&rs->v, src_h, dst_h, mode);
+    if (ok) {
+        int slots = rs->v.max_count;
+        rs->row = (unsigned char *)malloc((size_t)src_w * 3);
+        rs->ring = (uint16_t *)malloc((size_t)slots * dst_w * 3 * sizeof(uint16_t));
+        rs->tag = (int *)calloc(slots, sizeof(int));
+        rs->acc = (uint32_t *)malloc((size_t)dst_w * 3 * sizeof(uint32_t));
+        ok = rs->row && rs->ring && rs->tag && rs->acc;
+    }
+    if (!ok) {
+        mister_resampler_free(rs);
+        return NULL;
+    }
+    return rs;
+}
+
+void mister_resampler_free(mister_resampler *rs)
+{
+    if (!rs) return;
+    free_taps(&rs->h);
+    free_taps(&rs->v);
+    free(rs->row);
+    free(rs->ring);
+    free(rs->tag);
+    free(rs->acc);
+    free(rs);
+}
+
+// One source row scaled horizontally, with MID_BITS fraction bits.  Two
+// taps is the common case (bilinear, area up to 2x down) and gets its own loop.
+static void horizontal(const taps *h, const unsigned char *src, uint16_t *dst, int dst_w)
+{
+    const int round = 1 << (WEIGHT_BITS - MID_BITS - 1);
+    const int shift = WEIGHT_BITS - MID_BITS;
+    if (h->max_count == 2) {
+        for (int x = 0; x < dst_w; x++) {
+            const unsigned char *s = src + h->start[x] * 3;
+            uint32_t w0 = h->weight[2 * x], w1 = h->weight[2 * x + 1];
+            // a zero weight may sit past the end of the row
+            const unsigned char *t = w1 ? s + 3 : s;
+            dst[0] = (w0 * s[0] + w1 * t[0] + round) >> shift;
+            dst[1] = (w0 * s[1] + w1 * t[1] + round) >> shift;
+            dst[2] = (w0 * s[2] + w1 * t[2] + round) >> shift;
+            dst += 3;
+        }
+        return;
+    }
+    for (int x = 0; x < dst_w; x++) {
+        const unsigned char *s = src + h->start[x] * 3;
+        const uint16_t *w = &h->weight[(size_t)x * h->max_count];
+        uint32_t r = round, g = round, b = round;
+        for (int k = 0; k < h->count[x]; k++) {
+            r += w[k] * s[0];
+            g += w[k] * s[1];
+            b += w[k] * s[2];
+            s += 3;
+        }
+        dst[0] = r >> shift;
+        dst[1] = g >> shift;
+        dst[2] = b >> shift;
+        dst += 3;
+    }
+}
+
+static const uint16_t *fetch(mister_resampler *rs, mister_row_fn row, void *ctx, int y)
+{
+    int slot = y % rs->v.max_count;
+    uint16_t *scaled = rs->ring + (size_t)slot * rs->dst_w * 3;
+    if (rs->tag[slot] != y) {
+        horizontal(&rs->h, row(ctx, y, rs->row), scaled, rs->dst_w);
+        rs->tag[slot] = y;
+    }
+    return scaled;
+}
+
+static void nearest_row(const taps *h, const unsigned char *src, unsigned char *dst, int dst_w)
+{
+    for (int x = 0; x < dst_w; x++) {
+        const unsigned char *s = src + h->start[x] * 3;
+        *dst++ = s[0];
+        *dst++ = s[1];
+        *dst++ = s[2];
+    }
+}
+
+void mister_resample(mister_resampler *rs, mister_row_fn row, void *ctx, unsigned char *dst)
+{
+    int n = rs->dst_w * 3;
+    size_t stride = (size_t)rs->dst_w * 3;
+    for (int i = 0; i < rs->v.max_count; i++) rs->tag[i] = -1;
+
+    for (int y = 0; y < rs->dst_h; y++) {
+        unsigned char *out = dst + y * stride;
+        int s = rs->v.start[y], c = rs->v.count[y];
+
+        if (rs->mode == MISTER_SCALE_NEAREST) {
+            // rows that repeat the one before are a copy
+            if (y && s == rs->v.start[y - 1])
+                memcpy(out, out - stride, stride);
+            else
+                nearest_row(&rs->h, row(ctx, s, rs->row), out, rs->dst_w);
+            continue;
+        }
+
+        // the vertical pass runs over whole rows and vectorizes
+        const uint16_t *w = &rs->v.weight[(size_t)y * rs->v.max_count];
+        const uint16_t *src = fetch(rs, row, ctx, s);
+        if (c == 1) {
+            for (int x = 0; x < n; x++)
+                out[x] = (src[x] + (1 << (MID_BITS - 1))) >> MID_BITS;
+            continue;
+        }
+        uint32_t *acc = rs->acc;
+        uint32_t w0 = w[0];
+        for (int x = 0; x < n; x++) acc[x] = w0 * src[x];
+        for (int k = 1; k < c; k++) {
+            src = fetch(rs, row, ctx, s + k);
+            uint32_t wk = w[k];
+            for (int x = 0; x < n; x++) acc[x] += wk * src[x];
+        }
+        for (int x = 0; x < n; x++)
+            out[x] = (acc[x] + (1 << (WEIGHT_BITS + MID_BITS - 1))) >> (WEIGHT_BITS + MID_BITS);
+    }
+}
+
+struct packed_picture {
+    const unsigned char *src;
+    size_t stride;
+};
+
+static const unsigned char *packed_row(void *ctx, int y, unsigned char *)
+{
+    const packed_picture *p = (const packed_picture *)ctx;
+    return p->src + y * p->stride;
+}
+
+void mister_resample_rgb24(mister_resampler *rs, const unsigned char *src, unsigned char *dst)
+{
+    packed_picture p = { src, (size_t)rs->src_w * 3 };
+    mister_resample(rs, packed_row, &p, dst);
+}
@@ -0,0 +1,35 @@
+/*
+Separable RGB24 resampling for scaling captures to the size the core is
+displayed at.  The output is produced one row at a time from source rows
+that are pulled in order, so it runs straight off the ASCAL mapping with
+every source row converted once (mister_scaler_read_scaled).  Weights are
+14 bit fixed point and the row loops are plain enough for the vectorizer.
+*/
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+enum {
+   MISTER_SCALE_NEAREST = 0,   // pixel replication, exact for integer factors
+   MISTER_SCALE_AREA = 1,      // every output pixel is the mean of the area it covers
+   MISTER_SCALE_BILINEAR = 2
+};
+
+struct mister_resampler;
+
+mister_resampler *mister_resampler_create(int src_w, int src_h, int dst_w, int dst_h, int mode);
+void mister_resampler_free(mister_resampler *rs);
+
+// Returns source row y as src_w RGB24 pixels, either converted into buf
+// (src_w*3 bytes) or pointing at the row where it already is
+typedef const unsigned char *(*mister_row_fn)(void *ctx, int y, unsigned char *buf);
+
+void mister_resample(mister_resampler *rs, mister_row_fn row, void *ctx, unsigned char *dst);
+// The same for a packed RGB24 picture in memory
+void mister_resample_rgb24(mister_resampler *rs, const unsigned char *src, unsigned char *dst);
+
+// "nearest", "area" or "bilinear", -1 if unknown
+int mister_scale_parse(const char *name);
+const char *mister_scale_name(int mode);
+
+#endif
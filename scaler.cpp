@@ -8,21 +8,126 @@ with help from the MiSTer contributors including Grabulosaure
 #include <stdio.h>
 #include <sched.h>
 #include <inttypes.h>
+#include <math.h>
 #include <ctype.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <err.h>
 
+#include "crt.h"
+#include "resample.h"
 #include "scaler.h"
 #include "shmem.h"
+#include "trace.h"
 
 
+mister_pixfmt mister_pixfmt_decode(int format)
+{
+    mister_pixfmt pf;
+    pf.bgr = (format & 0x10) != 0;
+    pf.rgb1555 = false;
+
+    switch (format & 0x7) {
+        case 0x0:
+            pf.bpp = 1;
+            pf.name = "PAL8";
+            break;
+        case 0x1:
+            pf.bpp = 2;
+            pf.rgb1555 = (format & 0x8) != 0;
+            if (pf.rgb1555) pf.name = pf.bgr ? "BGR1555" : "RGB1555";
+            else            pf.name = pf.bgr ? "BGR565"  : "RGB565";
+            break;
+        case 0x2:
+            pf.bpp = 3;
+            pf.name = pf.bgr ? "BGR888" : "RGB888";
+            break;
+        case 0x3:
+            pf.bpp = 4;
+            pf.name = pf.bgr ? "ABGR8888" : "ARGB8888";
+            break;
+        default:
+            pf.bpp = 0;
+            pf.name = "Unknown";
+            break;
+    }
+    return pf;
+}
+
+int mister_pixfmt_parse(const char *name)
+{
+    static const int formats[] = { 0x00, 0x01, 0x09, 0x02, 0x03, 0x11, 0x19, 0x12, 0x13 };
+    for (unsigned i = 0; i < sizeof(formats)/sizeof(formats[0]); i++) {
+        if (!strcasecmp(name, mister_pixfmt_decode(formats[i]).name)) return formats[i];
+    }
+    return -1;
+}
+
+// The region clipped to the frame
+static void apply_roi(mister_scaler *ms)
+{
+    int x = ms->roi_x < ms->frame_width ? ms->roi_x : ms->frame_width;
+    int y = ms->roi_y < ms->frame_height ? ms->roi_y : ms->frame_height;
+    int w = ms->frame_width - x, h = ms->frame_height - y;
+    if (ms->roi_w && ms->roi_w < w) w = ms->roi_w;
+    if (ms->roi_h && ms->roi_h < h) h = ms->roi_h;
+    ms->crop_x = x;
+    ms->crop_y = y;
+    ms->width  = w;
+    ms->height = h;
+}
+
+// returns 1 if anything that affects reading the pixels changed
+static int parse_header(mister_scaler *ms, volatile unsigned char *buffer)
+{
+    int header = buffer[2]<<8 | buffer[3];
+    int width  = buffer[6]<<8 | buffer[7];
+    int height = buffer[8]<<8 | buffer[9];
+    int line   = buffer[10]<<8 | buffer[11];
+    int format = buffer[4];
+    int flags  = buffer[5];
+    int field  = ms->deinterlace && (flags & MISTER_SCALER_INTERLACED) ?
+                 (flags & MISTER_SCALER_FIELD ? 1 : 0) : -1;
+    int downscaled = flags & (MISTER_SCALER_HDOWNSCALED | MISTER_SCALER_VDOWNSCALED);
+
+    // the field number flips with every field and is no change
+    int changed = header != ms->header || width != ms->frame_width ||
+                  height != ms->field_height || line != ms->line ||
+                  format != ms->format || (field < 0) != (ms->field < 0) ||
+                  downscaled != ms->downscaled;
+
+    ms->header = header;
+    ms->frame_width  = width;
+    ms->frame_height = field < 0 ? height : 2*height;
+    ms->field_height = height;
+    ms->field  = field;
+    ms->line   = line;
+    ms->format = format;
+    ms->downscaled = downscaled;
+    ms->pixfmt = mister_pixfmt_decode(format);
+    ms->output_width =buffer[12]<<8 | buffer[13];
+    ms->output_height=buffer[14]<<8 | buffer[15];
+
+    // never let a bogus header point reads outside of the mapping
+    if (ms->buffer_off + ms->header + ms->field_height*ms->line > ms->num_bytes ||
+        ms->frame_width*ms->pixfmt.bpp > ms->line) {
+        ms->frame_height = ms->field_height = 0;
+    }
+
+    if (changed) ms->border_valid = 0;
+    apply_roi(ms);
+    return changed;
+}
+
 mister_scaler * mister_scaler_init()
 {
     mister_scaler *ms =(mister_scaler *) calloc(sizeof(mister_scaler),1);
+    ms->field = -1;
     int	 pagesize = sysconf(_SC_PAGE_SIZE);
     if (pagesize==0) pagesize=4096;
     int offset = MISTER_SCALER_BASEADDR;
@@ -31,26 +136,39 @@ mister_scaler * mister_scaler_init()
     ms->num_bytes=MISTER_SCALER_BUFFERSIZE;
     //printf("map_start = %d map_off=%d offset=%d\n",map_start,ms->map_off,offset);
 
-    unsigned char *buffer;
+    int span = trace_begin("map");
     ms->map=(char *)shmem_map(map_start, ms->num_bytes+ms->map_off);
+    trace_end(span);
     if (!ms->map)
     {
-        mister_scaler_free(ms);
+        free(ms);
         return NULL;
     }
-    buffer = (unsigned char *)(ms->map+ms->map_off);
+    volatile unsigned char *buffer = mister_scaler_buffer(ms);
     if (buffer[0]!=1 || buffer[1]!=1) {
         fprintf(stderr,"problem\n");
         mister_scaler_free(ms);
         return NULL;
     }
 
-    ms->header=buffer[2]<<8 | buffer[3];
-    ms->width =buffer[6]<<8 | buffer[7];
-    ms->height=buffer[8]<<8 | buffer[9];
-    ms->line  =buffer[10]<<8 | buffer[11];
-    ms->output_width =buffer[12]<<8 | buffer[13];
-    ms->output_height=buffer[14]<<8 | buffer[15];
+    // map the other two buffers as well
+    if (buffer[5] & MISTER_SCALER_TRIPLE) {
+        shmem_unmap(ms->map, ms->num_bytes+ms->map_off);
+        ms->num_bytes = MISTER_SCALER_TRIPLE_SIZE;
+        ms->map=(char *)shmem_map(map_start, ms->num_bytes+ms->map_off);
+        if (!ms->map)
+        {
+            free(ms);
+            return NULL;
+        }
+        ms->triple = 1;
+        buffer = mister_scaler_buffer(ms);
+        mister_scaler_select(ms);
+    }
+
+    span = trace_begin("header");
+    parse_header(ms, buffer + ms->buffer_off);
+    trace_end(span);
 
    /*
     printf (" 1: %02X %02X %02X %02X   %02X %02X %02X %02X   %02X %02X %02X %02X   %02X %02X %02X %02X\n",
@@ -62,77 +180,702 @@ mister_scaler * mister_scaler_init()
 
 }
 
+struct mister_fields {
+    int rows, bytes;            // field size the copies were made for
+    unsigned char *copy[2];     // the last field of each parity
+    int counter[2];             // its frame counter
+    int64_t time_us[2];         // when it was read, 0 when there is none
+    unsigned char *taken;       // rows of the field being read already copied
+};
+
+static void free_fields(mister_scaler *ms)
+{
+    mister_fields *f = ms->fields;
+    if (!f) return;
+    free(f->copy[0]);
+    free(f->copy[1]);
+    free(f->taken);
+    free(f);
+    ms->fields = NULL;
+}
+
+// The copies for weaving the current field size, NULL when not weaving
+static mister_fields *weave_fields(mister_scaler *ms)
+{
+    if (ms->deinterlace != MISTER_DEINTERLACE_WEAVE || ms->field < 0) return NULL;
+    int bytes = ms->width*ms->pixfmt.bpp;
+    mister_fields *f = ms->fields;
+    if (f && f->rows == ms->field_height && f->bytes == bytes) return f;
+
+    free_fields(ms);
+    f = (mister_fields *)calloc(1, sizeof(mister_fields));
+    if (!f) return NULL;
+    f->rows = ms->field_height;
+    f->bytes = bytes;
+    f->copy[0] = (unsigned char *)malloc((size_t)f->rows*bytes + 1);
+    f->copy[1] = (unsigned char *)malloc((size_t)f->rows*bytes + 1);
+    f->taken = (unsigned char *)malloc(f->rows + 1);
+    ms->fields = f;
+    if (!f->copy[0] || !f->copy[1] || !f->taken) {
+        free_fields(ms);
+        return NULL;
+    }
+    return f;
+}
+
 void mister_scaler_free(mister_scaler *ms)
 {
+   if (!ms) return;
    shmem_unmap(ms->map,ms->num_bytes+ms->map_off);
+   free_fields(ms);
    free(ms);
 }
 
+void mister_scaler_set_deinterlace(mister_scaler *ms, int mode)
+{
+    ms->deinterlace = mode;
+    mister_scaler_refresh(ms);
+}
+
+void mister_scaler_set_roi(mister_scaler *ms, int x, int y, int w, int h)
+{
+    x = x > 0 ? x : 0;
+    y = y > 0 ? y : 0;
+    w = w > 0 ? w : 0;
+    h = h > 0 ? h : 0;
+    if (x == ms->roi_x && y == ms->roi_y && w == ms->roi_w && h == ms->roi_h) return;
+    ms->roi_x = x;
+    ms->roi_y = y;
+    ms->roi_w = w;
+    ms->roi_h = h;
+    // the field copies only hold the rows of the old region
+    free_fields(ms);
+    apply_roi(ms);
+}
+
+int mister_roi_parse(const char *s, int *x, int *y, int *w, int *h)
+{
+    *x = *y = 0;
+    int n = sscanf(s, "%dx%d+%d+%d", w, h, x, y);
+    if ((n != 2 && n != 4) || *w < 0 || *h < 0 || *x < 0 || *y < 0) return -1;
+    return 0;
+}
+
+int mister_deinterlace_parse(const char *name)
+{
+    static const char *names[] = { "off", "weave", "double" };
+    for (int i = 0; i < 3; i++) {
+        if (!strcasecmp(name, names[i])) return i;
+    }
+    return -1;
+}
+
+static inline int counter_at(mister_scaler *ms, int index)
+{
+    return (mister_scaler_buffer(ms)[index * MISTER_SCALER_TRIPLE_STRIDE + 5] >> 5) & 0x07;
+}
+
+// The newest buffer is the one whose successor does not carry the next count
+static int newest_buffer(mister_scaler *ms)
+{
+    if (!ms->triple) return 0;
+    int fc[3] = { counter_at(ms, 0), counter_at(ms, 1), counter_at(ms, 2) };
+    for (int i = 0; i < 3; i++) {
+        if (fc[(i + 1) % 3] != ((fc[i] + 1) & 0x07)) return i;
+    }
+    return 0;
+}
+
+int mister_scaler_select(mister_scaler *ms)
+{
+    int index = ms->triple ? (newest_buffer(ms) + 2) % 3 : 0;
+    volatile unsigned char *hdr = mister_scaler_buffer(ms) + index * MISTER_SCALER_TRIPLE_STRIDE;
+    // stay on the first buffer if the others do not carry a header
+    if (hdr[0] != 1 || hdr[1] != 1) index = 0;
+    ms->buffer_off = index * MISTER_SCALER_TRIPLE_STRIDE;
+    return index;
+}
+
+int mister_scaler_refresh(mister_scaler *ms)
+{
+    mister_scaler_select(ms);
+    return parse_header(ms, mister_scaler_buffer(ms) + ms->buffer_off);
+}
+
+int mister_scaler_flags(mister_scaler *ms)
+{
+    return mister_scaler_buffer(ms)[ms->buffer_off + 5];
+}
+
+int mister_scaler_frame_counter(mister_scaler *ms)
+{
+    return counter_at(ms, newest_buffer(ms));
+}
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int mister_scaler_wait_frame(mister_scaler *ms, int timeout_ms)
+{
+    int start = mister_scaler_frame_counter(ms);
+    int64_t deadline = now_us() + (int64_t)timeout_ms * 1000;
+    do {
+        int fc = mister_scaler_frame_counter(ms);
+        if (fc != start) return fc;
+        usleep(500);
+    } while (now_us() < deadline);
+    return -1;
+}
+
+double mister_scaler_measure_refresh(mister_scaler *ms, int n)
+{
+    if (mister_scaler_wait_frame(ms, 1000) < 0)
+        return 0;
+    int64_t start = now_us();
+    for (int i = 0; i < n; i++) {
+        if (mister_scaler_wait_frame(ms, 1000) < 0)
+            return 0;
+    }
+    return n * 1e6 / (now_us() - start);
+}
+
+int64_t mister_frames_between(int fc_delta, double dt, double hz)
+{
+    int64_t expect = llround(dt * hz);
+    int64_t n = fc_delta + 8 * llround((expect - fc_delta) / 8.0);
+    return n < fc_delta ? fc_delta : n;
+}
+
+void mister_row_rgb24(const unsigned char *src, unsigned char *dst, int width, const mister_pixfmt *pf)
+{
+    if (pf->bpp == 3 && !pf->bgr) {
+        memcpy(dst, src, width*3);
+        return;
+    }
+    for (int x = 0; x < width; x++) {
+        uint32_t c = mister_pixel_rgb(src, pf);
+        *dst++ = c >> 16;
+        *dst++ = c >> 8;
+        *dst++ = c;
+        src += pf->bpp;
+    }
+}
+
+// Rows of the picture being read, from the top of the region.  Progressive
+// frames are the buffer as it is; a field is either line doubled or woven
+// with the copy of the field before, and with weaving every row of the
+// buffer is copied for the next field the first time it is handed out,
+// while it is hot in the cache.
+struct frame_rows {
+    const unsigned char *pixels;    // the buffer from the left edge of the region
+    int line;
+    int top;                // first row of the region in the frame
+    int height;
+    int mode;               // MISTER_DEINTERLACE_*, OFF for progressive frames
+    int field;              // field in the buffer
+    int rows;               // rows in the buffer
+    mister_fields *f;       // copies for weaving, or NULL
+
+    // row of the buffer holding frame row y, own is false for the other field
+    int field_row(int y, bool *own) const
+    {
+        int k;
+        *own = true;
+        if (mode == MISTER_DEINTERLACE_WEAVE) {
+            k = y >> 1;
+            *own = (y & 1) == field;
+        } else {
+            // the second field sits one line lower
+            k = field && y ? (y - 1) >> 1 : y >> 1;
+        }
+        return k < rows ? k : rows - 1;
+    }
+
+    const unsigned char *operator[](int y)
+    {
+        y += top;
+        if (mode == MISTER_DEINTERLACE_OFF) return pixels + y*line;
+        bool own;
+        int k = field_row(y, &own);
+        if (!own) return f->copy[!field] + (size_t)k*f->bytes;
+        const unsigned char *row = pixels + k*line;
+        if (f && !f->taken[k]) {
+            memcpy(f->copy[field] + (size_t)k*f->bytes, row, f->bytes);
+            f->taken[k] = 1;
+        }
+        return row;
+    }
+};
+
+// The copy of the other field is of the field right before this one
+static bool other_field_ready(const mister_fields *f, int field, int counter)
+{
+    return f->time_us[!field] && f->counter[!field] == ((counter - 1) & 0x07) &&
+           now_us() - f->time_us[!field] < 100000;
+}
+
+// Copies the rows of the field in the region that the read did not ask for
+static void finish_field(frame_rows &rows)
+{
+    mister_fields *f = rows.f;
+    bool own;
+    int last = rows.field_row(rows.top + rows.height - 1, &own);
+    for (int k = rows.field_row(rows.top, &own); k <= last; k++) {
+        if (!f->taken[k])
+            memcpy(f->copy[rows.field] + (size_t)k*f->bytes, rows.pixels + k*rows.line, f->bytes);
+    }
+}
+
+// Runs copy until the counter of the buffer being read stays the same across
+// it.  After a torn copy, wait for the next frame so the retry starts right
+// after the header update and has a whole frame time to finish.
+template <typename F>
+static int read_consistent(mister_scaler *ms, const char *stage, F copy)
+{
+    trace_scope trace(stage);
+    if (ms->frame) {
+        // already woven and cropped
+        frame_rows rows = { ms->frame, ms->width*ms->pixfmt.bpp, 0, ms->height,
+                            MISTER_DEINTERLACE_OFF, 0, ms->height, NULL };
+        copy(rows);
+        return 0;
+    }
+    bool waited = false;
+    for (int tries = 0; ; tries++) {
+        int index = mister_scaler_select(ms);
+        int before = counter_at(ms, index);
+        frame_rows rows = { mister_scaler_pixels(ms) + ms->crop_x*ms->pixfmt.bpp, ms->line,
+                            ms->crop_y, ms->height, MISTER_DEINTERLACE_OFF, 0, ms->field_height, NULL };
+        if (ms->field >= 0) {
+            int flags = mister_scaler_buffer(ms)[ms->buffer_off + 5];
+            rows.field = ms->field = flags & MISTER_SCALER_FIELD ? 1 : 0;
+            rows.mode = ms->deinterlace;
+            rows.f = weave_fields(ms);
+            if (rows.f) {
+                memset(rows.f->taken, 0, rows.f->rows);
+                if (!other_field_ready(rows.f, rows.field, before)) {
+                    if (!waited) {
+                        // keep this field and weave the next one with it
+                        finish_field(rows);
+                        if (counter_at(ms, index) == before) {
+                            rows.f->counter[rows.field] = before;
+                            rows.f->time_us[rows.field] = now_us();
+                        }
+                        waited = true;
+                        mister_scaler_wait_frame(ms, 100);
+                        tries--;
+                        continue;
+                    }
+                    rows.mode = MISTER_DEINTERLACE_DOUBLE;
+                }
+            } else if (rows.mode == MISTER_DEINTERLACE_WEAVE) {
+                rows.mode = MISTER_DEINTERLACE_DOUBLE;
+            }
+        }
+        copy(rows);
+        int after = counter_at(ms, index);
+        if (rows.f) {
+            finish_field(rows);
+            rows.f->counter[rows.field] = before;
+            rows.f->time_us[rows.field] = before == after ? now_us() : 0;
+        }
+        if (before == after) {
+            ms->tear_retries = tries;
+            ms->counter = before;
+            return 0;
+        }
+        if (tries == MISTER_SCALER_MAX_RETRIES) {
+            ms->tear_retries = tries;
+            ms->counter = after;
+            return 1;
+        }
+        mister_scaler_wait_frame(ms, 100);
+    }
+}
+
+// span name for reads into RGB, RGB888 is copied without conversion
+static const char *rgb_stage(mister_scaler *ms)
+{
+    return (ms->pixfmt.bpp == 3 && !ms->pixfmt.bgr) ? "copy" : "copy+convert";
+}
+
 int mister_scaler_read_yuv(mister_scaler *ms,int lineY,unsigned char *bufY, int lineU, unsigned char *bufU, int lineV, unsigned char *bufV)
 {
-    unsigned char *buffer;
-    buffer = (unsigned char *)(ms->map+ms->map_off);
-
-    // do this slow way for now..
-    unsigned char *pixbuf;
-    unsigned char *outbufy;
-    unsigned char *outbufU;
-    unsigned char *outbufV;
-    for (int  y=0; y< ms->height ; y++)
-	{
-        pixbuf=&buffer[ms->header + y*ms->line];
-        outbufy=&bufY[y*(lineY)];
-        outbufU=&bufU[y*(lineU)];
-        outbufV=&bufV[y*(lineV)];
-        for (int x = 0; x < ms->width ; x++)
-		{
-			int R,G,B;
-			R = *pixbuf++;
-			G = *pixbuf++;
-			B = *pixbuf++;
-			int Y =  (0.257 * R) + (0.504 * G) + (0.098 * B) + 16;
-			int U = -(0.148 * R) - (0.291 * G) + (0.439 * B) + 128;
-			int V =  (0.439 * R) - (0.368 * G) - (0.071 * B) + 128;
-
-			*outbufy++ = Y;
-			*outbufU++ = U;
-			*outbufV++ = V;
+    return read_consistent(ms, "copy+yuv", [&](frame_rows &rows) {
+        for (int y=0; y< ms->height ; y++)
+        {
+            const unsigned char *pixbuf=rows[y];
+            unsigned char *outbufy=&bufY[y*(lineY)];
+            unsigned char *outbufU=&bufU[y*(lineU)];
+            unsigned char *outbufV=&bufV[y*(lineV)];
+            for (int x = 0; x < ms->width ; x++)
+            {
+                uint32_t c = mister_pixel_rgb(pixbuf, &ms->pixfmt);
+                int R = (c >> 16) & 0xFF;
+                int G = (c >> 8) & 0xFF;
+                int B = c & 0xFF;
+                pixbuf += ms->pixfmt.bpp;
+
+                // BT.601 studio swing in 8 bit fixed point
+                *outbufy++ = (( 66 * R + 129 * G +  25 * B + 128) >> 8) + 16;
+                *outbufU++ = ((-38 * R -  74 * G + 112 * B + 128) >> 8) + 128;
+                *outbufV++ = ((112 * R -  94 * G -  18 * B + 128) >> 8) + 128;
+            }
         }
+    });
+}
+
+// The 4:2:0 converter works on strips of this many pixels of two rows at a
+// time: the rows are first split into R, G and B planes, then luma and the
+// chroma of each 2x2 block come out of plain loops over those planes, which
+// the compiler vectorizes (NEON on the MiSTer).  The planes stay in L1.
+#define I420_STRIP 256
+
+template <int BPP, bool BGR, bool RGB1555>
+static inline void planarize(const unsigned char *src, int n, unsigned char *R, unsigned char *G, unsigned char *B)
+{
+    const mister_pixfmt pf = { BPP, BGR, RGB1555, NULL };
+    for (int x = 0; x < n; x++) {
+        uint32_t c = mister_pixel_rgb(src + x*BPP, &pf);
+        R[x] = c >> 16;
+        G[x] = c >> 8;
+        B[x] = c;
     }
+}
 
-    return 0;
+struct i420_planes {
+    unsigned char R[2][I420_STRIP], G[2][I420_STRIP], B[2][I420_STRIP];
+};
+
+static inline void i420_strip(const i420_planes &p, int n, int rows,
+                              unsigned char *Y0, unsigned char *Y1, unsigned char *U, unsigned char *V)
+{
+    for (int r = 0; r < rows; r++) {
+        unsigned char *Y = r ? Y1 : Y0;
+        for (int x = 0; x < n; x++)
+            Y[x] = (( 66 * p.R[r][x] + 129 * p.G[r][x] +  25 * p.B[r][x] + 128) >> 8) + 16;
+    }
+    // sums of the 2x2 blocks, the averaging is folded into the final shift
+    for (int x = 0; x < (n + 1) / 2; x++) {
+        int R = p.R[0][2*x] + p.R[0][2*x+1] + p.R[1][2*x] + p.R[1][2*x+1];
+        int G = p.G[0][2*x] + p.G[0][2*x+1] + p.G[1][2*x] + p.G[1][2*x+1];
+        int B = p.B[0][2*x] + p.B[0][2*x+1] + p.B[1][2*x] + p.B[1][2*x+1];
+        U[x] = ((-38 * R -  74 * G + 112 * B + 512) >> 10) + 128;
+        V[x] = ((112 * R -  94 * G -  18 * B + 512) >> 10) + 128;
+    }
 }
 
-int mister_scaler_read(mister_scaler *ms,unsigned char *gbuf)
+template <int BPP, bool BGR, bool RGB1555>
+static void i420_frame(int width, int height, frame_rows &buffer,
+                       int lineY, unsigned char *bufY, int lineU, unsigned char *bufU, int lineV, unsigned char *bufV)
 {
-    unsigned char *buffer;
-    buffer = (unsigned char *)(ms->map+ms->map_off);
+    i420_planes p;
+    for (int y = 0; y < height; y += 2) {
+        // an odd last row and column pair up with themselves
+        int rows = y + 1 < height ? 2 : 1;
+        const unsigned char *src[2] = { buffer[y], buffer[y + rows - 1] };
+        for (int x = 0; x < width; x += I420_STRIP) {
+            int n = width - x < I420_STRIP ? width - x : I420_STRIP;
+            for (int r = 0; r < 2; r++) {
+                planarize<BPP, BGR, RGB1555>(src[r] + x*BPP, n, p.R[r], p.G[r], p.B[r]);
+                if (n & 1) {
+                    p.R[r][n] = p.R[r][n-1];
+                    p.G[r][n] = p.G[r][n-1];
+                    p.B[r][n] = p.B[r][n-1];
+                }
+            }
+            i420_strip(p, n, rows, &bufY[y*lineY + x], rows == 2 ? &bufY[(y+1)*lineY + x] : NULL,
+                       &bufU[y/2*lineU + x/2], &bufV[y/2*lineV + x/2]);
+        }
+    }
+}
 
-    for (int y = 0; y < ms->height; y++) {
-        memcpy(&gbuf[y*(ms->width*3)], &buffer[ms->header + y*ms->line], ms->width*3);
+// Chroma is the average of each 2x2 block, every source row is read once and
+// every chroma row written once.  Odd sizes get ceil(width/2) x ceil(height/2)
+// chroma samples.
+int mister_scaler_read_i420(mister_scaler *ms,int lineY,unsigned char *bufY, int lineU, unsigned char *bufU, int lineV, unsigned char *bufV)
+{
+    void (*frame)(int, int, frame_rows &, int, unsigned char *, int, unsigned char *, int, unsigned char *);
+    const mister_pixfmt &pf = ms->pixfmt;
+    switch (pf.bpp) {
+        case 1:  frame = i420_frame<1, false, false>; break;
+        case 2:
+            if (pf.rgb1555) frame = pf.bgr ? i420_frame<2, true, true> : i420_frame<2, false, true>;
+            else            frame = pf.bgr ? i420_frame<2, true, false> : i420_frame<2, false, false>;
+            break;
+        case 3:  frame = pf.bgr ? i420_frame<3, true, false> : i420_frame<3, false, false>; break;
+        case 4:  frame = pf.bgr ? i420_frame<4, true, false> : i420_frame<4, false, false>; break;
+        default: frame = i420_frame<0, false, false>; break;   // black like the other reads
     }
+    return read_consistent(ms, "copy+yuv", [&](frame_rows &rows) {
+        frame(ms->width, ms->height, rows, lineY, bufY, lineU, bufU, lineV, bufV);
+    });
+}
 
-    return 0;
+void mister_rgb24_i420(const unsigned char *rgb, int width, int height,
+                       int lineY, unsigned char *bufY, int lineU, unsigned char *bufU, int lineV, unsigned char *bufV)
+{
+    trace_scope trace("i420");
+    frame_rows rows;
+    memset(&rows, 0, sizeof(rows));
+    rows.pixels = rgb;
+    rows.line = width*3;
+    rows.height = height;
+    rows.mode = MISTER_DEINTERLACE_OFF;
+    i420_frame<3, false, false>(width, height, rows, lineY, bufY, lineU, bufU, lineV, bufV);
 }
 
-int mister_scaler_read_32(mister_scaler *ms, unsigned char *gbuf) {
-    unsigned char *buffer;
-    buffer = (unsigned char *)(ms->map+ms->map_off);
-
-    // do this slow way for now..  - could use a memcpy?
-    unsigned char *pixbuf;
-    unsigned char *outbuf;
-    for (int  y=0; y< ms->height ; y++) {
-          pixbuf=&buffer[ms->header + y*ms->line];
-          outbuf=&gbuf[y*(ms->width*4)];
-          for (int x = 0; x < ms->width ; x++) {
-            outbuf[2] = *pixbuf++;
-            outbuf[1] = *pixbuf++;
-            outbuf[0] = *pixbuf++;
-            outbuf[3] = 0xFF;
-	    outbuf+=4;
-          }
+static inline bool lit(const unsigned char *pix, const mister_pixfmt *pf, int level)
+{
+    uint32_t c = mister_pixel_rgb(pix, pf);
+    return (int)(c >> 16) > level || (int)((c >> 8) & 0xFF) > level || (int)(c & 0xFF) > level;
+}
+
+// Index of the first of n lines, counted in from an edge, with a lit pixel.
+// probe(i, step) looks at every step-th pixel of line i.  Lines are probed
+// sparsely every MISTER_BORDER_STEP, then the ones after the last dark probe
+// in full.  n when every probe is dark.
+template <typename P>
+static int first_lit(int n, P probe)
+{
+    int i = 0, dark = -1;
+    while (i < n && !probe(i, MISTER_BORDER_STEP)) {
+        dark = i;
+        // always probe the last line
+        i = i + MISTER_BORDER_STEP < n || i == n - 1 ? i + MISTER_BORDER_STEP : n - 1;
     }
+    if (i >= n) return n;
+    for (int j = dark + 1; j < i; j++) {
+        if (probe(j, 1)) return j;
+    }
+    return i;
+}
 
+int mister_scaler_find_border(mister_scaler *ms, int level, int *x, int *y, int *w, int *h)
+{
+    trace_scope trace("border");
+    mister_scaler_select(ms);
+    const unsigned char *pixels = mister_scaler_pixels(ms);
+    const mister_pixfmt *pf = &ms->pixfmt;
+    int width = ms->frame_width, rows = ms->field_height, bpp = pf->bpp;
+    if (!bpp || !width || !rows) return -1;
+
+    int top = first_lit(rows, [&](int k, int step) {
+        const unsigned char *row = pixels + k*ms->line;
+        for (int i = 0; i < width; i += step)
+            if (lit(row + i*bpp, pf, level)) return true;
+        return false;
+    });
+    if (top == rows) return -1;
+    int bottom = rows - first_lit(rows - top, [&](int k, int step) {
+        const unsigned char *row = pixels + (rows - 1 - k)*ms->line;
+        for (int i = 0; i < width; i += step)
+            if (lit(row + i*bpp, pf, level)) return true;
+        return false;
+    });
+    // the lit pixel of the top row may sit between the probes
+    if (bottom <= top) bottom = top + 1;
+    auto column = [&](int i, int step) {
+        for (int k = top; k < bottom; k += step)
+            if (lit(pixels + k*ms->line + i*bpp, pf, level)) return true;
+        return false;
+    };
+    int left = first_lit(width, column);
+    int right = width - first_lit(width - left, [&](int i, int step) {
+        return column(width - 1 - i, step);
+    });
+    // and so may the ones of the sides
+    if (left >= right) {
+        left = 0;
+        right = width;
+    }
+
+    // a field stands for two lines of the frame
+    int scale = ms->field < 0 ? 1 : 2;
+    *x = left;
+    *y = top*scale;
+    *w = right - left;
+    *h = (bottom - top)*scale;
+    return 0;
+}
+
+int mister_scaler_auto_crop(mister_scaler *ms, int level)
+{
+    if (!ms->border_valid) {
+        if (mister_scaler_find_border(ms, level, &ms->border_x, &ms->border_y,
+                                      &ms->border_w, &ms->border_h)) {
+            mister_scaler_set_roi(ms, 0, 0, 0, 0);
+            return -1;
+        }
+        ms->border_valid = 1;
+    }
+    mister_scaler_set_roi(ms, ms->border_x, ms->border_y, ms->border_w, ms->border_h);
     return 0;
 }
+
+int mister_scaler_read_raw(mister_scaler *ms, unsigned char *buffer)
+{
+    int bytes = ms->width*ms->pixfmt.bpp;
+    return read_consistent(ms, "copy", [&](frame_rows &rows) {
+        for (int y = 0; y < ms->height; y++) {
+            memcpy(&buffer[y*bytes], rows[y], bytes);
+        }
+    });
+}
+
+// FNV-1a over 64 bit words instead of bytes, one multiply per 8 bytes
+static inline uint64_t hash_row(uint64_t hash, const unsigned char *row, int bytes)
+{
+    const uint64_t prime = 1099511628211ULL;
+    int x = 0;
+    for (; x + 8 <= bytes; x += 8) {
+        uint64_t v;
+        memcpy(&v, row + x, 8);
+        hash = (hash ^ v) * prime;
+    }
+    for (; x < bytes; x++)
+        hash = (hash ^ row[x]) * prime;
+    return hash;
+}
+
+#define HASH_START 1469598103934665603ULL
+
+int mister_scaler_hash(mister_scaler *ms, uint64_t *hash)
+{
+    return read_consistent(ms, "hash", [&](frame_rows &rows) {
+        uint64_t h = HASH_START;
+        for (int y = 0; y < ms->height; y++) {
+            h = hash_row(h, rows[y], ms->width*ms->pixfmt.bpp);
+        }
+        *hash = h;
+    });
+}
+
+uint64_t mister_frame_hash(const unsigned char *raw, int width, int height, const mister_pixfmt *pf)
+{
+    trace_scope trace("hash");
+    uint64_t h = HASH_START;
+    int bytes = width*pf->bpp;
+    for (int y = 0; y < height; y++) {
+        h = hash_row(h, raw + (size_t)y*bytes, bytes);
+    }
+    return h;
+}
+
+void mister_scaler_set_frame(mister_scaler *ms, const unsigned char *raw)
+{
+    ms->frame = raw;
+}
+
+// Planar RGB in FFmpeg's gbrp order, lossless for every format
+int mister_scaler_read_gbrp(mister_scaler *ms,int lineG,unsigned char *bufG, int lineB, unsigned char *bufB, int lineR, unsigned char *bufR)
+{
+    return read_consistent(ms, "copy+convert", [&](frame_rows &rows) {
+        for (int y=0; y< ms->height ; y++)
+        {
+            const unsigned char *pixbuf=rows[y];
+            unsigned char *outG=&bufG[y*lineG];
+            unsigned char *outB=&bufB[y*lineB];
+            unsigned char *outR=&bufR[y*lineR];
+            for (int x = 0; x < ms->width ; x++)
+            {
+                uint32_t c = mister_pixel_rgb(pixbuf, &ms->pixfmt);
+                outR[x] = c >> 16;
+                outG[x] = c >> 8;
+                outB[x] = c;
+                pixbuf += ms->pixfmt.bpp;
+            }
+        }
+    });
+}
+
+struct scaled_source {
+    mister_scaler *ms;
+    frame_rows *rows;
+};
+
+// RGB888 rows are used where they are in the mapping
+static const unsigned char *scaled_row(void *ctx, int y, unsigned char *buf)
+{
+    scaled_source *src = (scaled_source *)ctx;
+    mister_scaler *ms = src->ms;
+    const unsigned char *row = (*src->rows)[y];
+    if (ms->pixfmt.bpp == 3 && !ms->pixfmt.bgr) return row;
+    mister_row_rgb24(row, buf, ms->width, &ms->pixfmt);
+    return buf;
+}
+
+int mister_scaler_read_scaled(mister_scaler *ms, mister_resampler *rs, unsigned char *buffer)
+{
+    return read_consistent(ms, "copy+scale", [&](frame_rows &rows) {
+        scaled_source src = { ms, &rows };
+        mister_resample(rs, scaled_row, &src, buffer);
+    });
+}
+
+int mister_scaler_read_crt(mister_scaler *ms, mister_crt *crt, unsigned char *buffer, int stride)
+{
+    return read_consistent(ms, "copy+crt", [&](frame_rows &rows) {
+        scaled_source src = { ms, &rows };
+        mister_crt_run(crt, scaled_row, &src, buffer, stride);
+    });
+}
+
+struct thumb_source {
+    mister_scaler *ms;
+    frame_rows *rows;
+    unsigned char *buffer;
+    int next;               // first row not converted yet
+};
+
+// Converts the rows up to y into the picture, the resampler gets them from there
+static const unsigned char *thumb_row(void *ctx, int y, unsigned char *)
+{
+    thumb_source *src = (thumb_source *)ctx;
+    mister_scaler *ms = src->ms;
+    size_t stride = (size_t)ms->width*3;
+    for (; src->next <= y; src->next++)
+        mister_row_rgb24((*src->rows)[src->next], src->buffer + src->next*stride, ms->width, &ms->pixfmt);
+    return src->buffer + y*stride;
+}
+
+int mister_scaler_read_thumb(mister_scaler *ms, unsigned char *buffer, mister_resampler *rs, unsigned char *thumb)
+{
+    return read_consistent(ms, "copy+thumb", [&](frame_rows &rows) {
+        thumb_source src = { ms, &rows, buffer, 0 };
+        mister_resample(rs, thumb_row, &src, thumb);
+        // rows below the last one the resampler needed
+        if (ms->height) thumb_row(&src, ms->height - 1, NULL);
+    });
+}
+
+int mister_scaler_read(mister_scaler *ms,unsigned char *gbuf)
+{
+    return read_consistent(ms, rgb_stage(ms), [&](frame_rows &rows) {
+        for (int y = 0; y < ms->height; y++) {
+            mister_row_rgb24(rows[y], &gbuf[y*(ms->width*3)], ms->width, &ms->pixfmt);
+        }
+    });
+}
+
+int mister_scaler_read_32(mister_scaler *ms, unsigned char *gbuf) {
+    return read_consistent(ms, "copy+convert", [&](frame_rows &rows) {
+        for (int y=0; y< ms->height ; y++) {
+            const unsigned char *pixbuf=rows[y];
+            unsigned char *outbuf=&gbuf[y*(ms->width*4)];
+            for (int x = 0; x < ms->width ; x++) {
+                uint32_t c = mister_pixel_rgb(pixbuf, &ms->pixfmt);
+                outbuf[2] = c >> 16;
+                outbuf[1] = c >> 8;
+                outbuf[0] = c;
+                outbuf[3] = 0xFF;
+                outbuf+=4;
+                pixbuf+=ms->pixfmt.bpp;
+            }
+        }
+    });
+}
@@ -6,6 +6,16 @@ with help from the MiSTer contributors including Grabulosaure
 #ifndef SCALER_H
 #define SCALER_H
 
+#include <stdint.h>
+
+// Pixel format decoded from header byte 4
+typedef struct {
+   int  bpp;          // bytes per pixel, 0 when the format is unknown
+   bool bgr;
+   bool rgb1555;
+   const char *name;
+} mister_pixfmt;
+
 typedef struct {
    int header;
    int width;
@@ -13,6 +23,29 @@ typedef struct {
    int line;
    int output_width;
    int output_height;
+   int format;        // header byte 4
+   mister_pixfmt pixfmt;
+   // MISTER_SCALER_HDOWNSCALED and VDOWNSCALED from header byte 5: the scaler
+   // shrank the picture to fit the output, the buffer is smaller than the core
+   int downscaled;
+
+   int tear_retries;  // retries needed by the last read
+   int counter;       // frame counter (header byte 5, 3 bits) of the frame the last read returned
+
+   int triple;        // triple buffered, see mister_scaler_select
+   int buffer_off;    // offset of the buffer being read from the first one
+
+   int roi_x, roi_y, roi_w, roi_h;  // region asked for, see mister_scaler_set_roi
+   int crop_x, crop_y;              // where width x height starts in the frame
+   int frame_width, frame_height;   // the whole frame
+   int border_x, border_y, border_w, border_h;  // kept by mister_scaler_auto_crop
+   int border_valid;                // until the header changes
+
+   int deinterlace;   // MISTER_DEINTERLACE_*, see mister_scaler_set_deinterlace
+   int field;         // field in the buffer when deinterlacing one, else -1
+   int field_height;  // rows in the buffer, height is twice that when deinterlacing
+   struct mister_fields *fields;  // the last field of each parity, for weaving
+   const unsigned char *frame;    // copy the reads convert from, see mister_scaler_set_frame
 
    char *map;
    int num_bytes;
@@ -21,11 +54,180 @@ typedef struct {
 
 #define MISTER_SCALER_BASEADDR     0x20000000
 #define MISTER_SCALER_BUFFERSIZE   2048*3*1024
+// with triple buffering the other buffers follow at this stride
+#define MISTER_SCALER_TRIPLE_STRIDE 0x800000
+#define MISTER_SCALER_TRIPLE_SIZE  (2*MISTER_SCALER_TRIPLE_STRIDE + MISTER_SCALER_BUFFERSIZE)
+
+// header byte 5
+#define MISTER_SCALER_INTERLACED   0x01
+#define MISTER_SCALER_FIELD        0x02
+#define MISTER_SCALER_HDOWNSCALED  0x04
+#define MISTER_SCALER_VDOWNSCALED  0x08
+#define MISTER_SCALER_TRIPLE       0x10
+
+// Interlaced cores fill the buffer with one field at a time, at half height
+enum {
+   MISTER_DEINTERLACE_OFF = 0,     // read the field as it is
+   MISTER_DEINTERLACE_WEAVE = 1,   // interleave it with the field before
+   MISTER_DEINTERLACE_DOUBLE = 2   // repeat every line of it
+};
+
+// how often a read is repeated when the frame counter moved during the copy
+#define MISTER_SCALER_MAX_RETRIES  3
 
 mister_scaler *mister_scaler_init();
+void mister_scaler_free(mister_scaler *);
+
+// Re-reads the header, returns 1 when the geometry or format changed
+int mister_scaler_refresh(mister_scaler *ms);
+int mister_scaler_flags(mister_scaler *ms);
+// Counter of the most recently started frame
+int mister_scaler_frame_counter(mister_scaler *ms);
+// Points the reads at the newest complete buffer.  Every buffer starts with
+// its own header and they are written round robin, so with triple buffering
+// this is the one before the buffer with the newest counter; it will not be
+// touched for another frame time.  Returns the buffer index.
+int mister_scaler_select(mister_scaler *ms);
+// Makes every read of an interlaced core return whole frames, height becomes
+// the frame height.  Weaving keeps a copy of each field, taken row by row
+// while it is read, for the next one; a read that has no fresh copy of the
+// other field waits one field for it, and doubles the lines if it does not
+// come.  Progressive cores are read as before.
+void mister_scaler_set_deinterlace(mister_scaler *ms, int mode);
+// "off", "weave" or "double", -1 if unknown
+int mister_deinterlace_parse(const char *name);
+// Restricts every read to a rectangle of the frame, width and height become
+// its size and only its rows and columns are read from the mapping.  w or h
+// 0 runs to the edge, the region is clipped to the frame and follows it
+// across header changes.  mister_scaler_set_roi(ms, 0, 0, 0, 0) reads all.
+void mister_scaler_set_roi(mister_scaler *ms, int x, int y, int w, int h);
+// "WxH+X+Y" or "WxH", returns 0 on success
+int mister_roi_parse(const char *s, int *x, int *y, int *w, int *h);
+
+// pixels with no channel above this count as black border
+#define MISTER_BORDER_LEVEL 16
+// Rectangle of the frame inside its black border, the pixels outside all have
+// no channel above level.  Rows and columns are probed sparsely in from each
+// edge, every MISTER_BORDER_STEP pixels and every MISTER_BORDER_STEP lines,
+// and only the lines between the last dark probe and the first lit one are
+// read in full, so a typical frame costs a few percent of a read.  Details
+// smaller than the probe grid in the border are taken for black.  Returns -1
+// for an all black frame.
+#define MISTER_BORDER_STEP 8
+int mister_scaler_find_border(mister_scaler *ms, int level, int *x, int *y, int *w, int *h);
+// Sets the region to the border found in the frame, which is kept until the
+// header changes (mister_scaler_refresh), so it is looked for once per
+// resolution and core.  An all black frame is read whole and not kept.
+// Returns 0 when cropped.
+int mister_scaler_auto_crop(mister_scaler *ms, int level);
+
+// Polls until the frame counter moves, returns the new counter or -1 on timeout
+int mister_scaler_wait_frame(mister_scaler *ms, int timeout_ms);
+// Times n frame counter changes, the cores run at anything from 50 to 61 Hz.
+// Returns the rate in Hz, 0 when the counter stopped.
+double mister_scaler_measure_refresh(mister_scaler *ms, int n);
+// Frames elapsed between two polls dt seconds apart that saw the counter move
+// by fc_delta ((new - old) & 7).  The counter only has 3 bits, so the clock
+// decides how many times it wrapped.
+int64_t mister_frames_between(int fc_delta, double dt, double hz);
+
+static inline volatile unsigned char *mister_scaler_buffer(mister_scaler *ms)
+{
+   return (volatile unsigned char *)(ms->map + ms->map_off);
+}
+
+// Pixel rows are read with plain loads, only the header is volatile
+static inline const unsigned char *mister_scaler_pixels(mister_scaler *ms)
+{
+   return (const unsigned char *)(ms->map + ms->map_off + ms->buffer_off + ms->header);
+}
+
+// The read functions convert any pixel format.  They return 0 for a frame
+// that was copied while the frame counter stood still and 1 when it kept
+// moving for MISTER_SCALER_MAX_RETRIES attempts (the buffer is still filled).
 int mister_scaler_read(mister_scaler *,unsigned char *buffer);
 int mister_scaler_read_32(mister_scaler *ms, unsigned char *buffer);
 int mister_scaler_read_yuv(mister_scaler *ms,int,unsigned char *y,int, unsigned char *U,int, unsigned char *V);
-void mister_scaler_free(mister_scaler *);
+// YUV 4:2:0 planes straight from the mapping, e.g. into an AVFrame, with the
+// chroma of every 2x2 block averaged
+int mister_scaler_read_i420(mister_scaler *ms,int,unsigned char *y,int, unsigned char *U,int, unsigned char *V);
+// The same conversion for a packed RGB24 picture, e.g. mister_crt output
+void mister_rgb24_i420(const unsigned char *rgb, int width, int height,
+                       int lineY, unsigned char *y, int lineU, unsigned char *U, int lineV, unsigned char *V);
+// Planar G, B, R (AV_PIX_FMT_GBRP) for lossless codecs
+int mister_scaler_read_gbrp(mister_scaler *ms,int,unsigned char *g,int, unsigned char *b,int, unsigned char *r);
+// Native pixel format, rows of width*bpp bytes without the line padding
+int mister_scaler_read_raw(mister_scaler *ms, unsigned char *buffer);
+// RGB24 scaled by a resampler made for width x height (resample.h), each
+// source row is converted once on the way
+struct mister_resampler;
+int mister_scaler_read_scaled(mister_scaler *ms, mister_resampler *rs, unsigned char *buffer);
+// RGB24 upscaled with scanlines by a mister_crt made for width x height
+// (crt.h), rows stride bytes apart; each source row is converted once
+struct mister_crt;
+int mister_scaler_read_crt(mister_scaler *ms, mister_crt *crt, unsigned char *buffer, int stride);
+// RGB24 like mister_scaler_read and, in the same pass, a smaller copy of it
+// by a resampler made for width x height, fed with every row right after it
+// is converted; for thumbnails without reading the picture twice
+int mister_scaler_read_thumb(mister_scaler *ms, unsigned char *buffer, mister_resampler *rs, unsigned char *thumb);
+
+// Hash of every visible pixel, equal hashes mean an identical frame for all
+// practical purposes.  It has to look at every pixel, so over the uncached
+// mapping it costs as much as a read; a frame that is converted as well is
+// better read once with mister_scaler_read_raw, hashed with mister_frame_hash
+// and converted from that copy (mister_scaler_set_frame).
+int mister_scaler_hash(mister_scaler *ms, uint64_t *hash);
+// The same hash over a frame copied by mister_scaler_read_raw
+uint64_t mister_frame_hash(const unsigned char *raw, int width, int height, const mister_pixfmt *pf);
+// Points every read at a frame copied by mister_scaler_read_raw of the same
+// size instead of the mapping, NULL goes back to the mapping.  The reads then
+// only convert cached memory and return 0, whether the copy tore is what
+// mister_scaler_read_raw returned.
+void mister_scaler_set_frame(mister_scaler *ms, const unsigned char *raw);
+
+mister_pixfmt mister_pixfmt_decode(int format);
+// Header byte 4 for a format name such as "rgb565" or "BGR888", -1 if unknown
+int mister_pixfmt_parse(const char *name);
+
+// Decode one pixel to 0xRRGGBB, PAL8 is treated as grey
+static inline uint32_t mister_pixel_rgb(const unsigned char *pix, const mister_pixfmt *pf)
+{
+   int r = 0, g = 0, b = 0;
+   if (pf->bpp == 1) {
+      r = g = b = pix[0];
+   } else if (pf->bpp == 2) {
+      int v = pix[0] | pix[1] << 8;
+      if (pf->rgb1555) {
+         r = (v >> 10) & 0x1F;
+         g = (v >> 5) & 0x1F;
+         b = v & 0x1F;
+         r = (r << 3) | (r >> 2);
+         g = (g << 3) | (g >> 2);
+         b = (b << 3) | (b >> 2);
+      } else {
+         r = (v >> 11) & 0x1F;
+         g = (v >> 5) & 0x3F;
+         b = v & 0x1F;
+         r = (r << 3) | (r >> 2);
+         g = (g << 2) | (g >> 4);
+         b = (b << 3) | (b >> 2);
+      }
+      if (pf->bgr) { int tmp = r; r = b; b = tmp; }
+   } else if (pf->bpp >= 3) {
+      if (pf->bgr) {
+         b = pix[0];
+         g = pix[1];
+         r = pix[2];
+      } else {
+         r = pix[0];
+         g = pix[1];
+         b = pix[2];
+      }
+   }
+   return (r << 16) | (g << 8) | b;
+}
+
+// Convert one row of width pixels to packed RGB24
+void mister_row_rgb24(const unsigned char *src, unsigned char *dst, int width, const mister_pixfmt *pf);
 
 #endif
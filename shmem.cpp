@@ -14,21 +14,56 @@
 #include "shmem.h"
 
 static int memfd = -1;
+static uint32_t membase = 0;
+
+int shmem_set_source(const char *path, uint32_t base)
+{
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd == -1)
+	{
+		printf("Error: Unable to open %s!\n", path);
+		return 0;
+	}
+
+	shmem_set_source_fd(fd, base);
+	return 1;
+}
+
+void shmem_set_source_fd(int fd, uint32_t base)
+{
+	if (memfd >= 0) close(memfd);
+	memfd = fd;
+	membase = base;
+}
 
 void *shmem_map(uint32_t address, uint32_t size)
 {
 	if (memfd < 0)
 	{
-		memfd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC);
-		if (memfd == -1)
+		const char *path = getenv("MISTER_MEM");
+		if (path)
+		{
+			if (!shmem_set_source(path, 0x20000000)) return 0;
+		}
+		else
 		{
-			printf("Error: Unable to open /dev/mem!\n");
-			return 0;
+			memfd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC);
+			if (memfd == -1)
+			{
+				printf("Error: Unable to open /dev/mem!\n");
+				return 0;
+			}
 		}
 	}
 
-	void *res = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, address);
-	if (res == (void *)-1)
+	if (address < membase)
+	{
+		printf("Error: Address 0x%X is below the memory source!\n", address);
+		return 0;
+	}
+
+	void *res = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, address - membase);
+	if (res == MAP_FAILED)
 	{
 		printf("Error: Unable to mmap (0x%X, %d)!\n", address, size);
 		return 0;
@@ -41,7 +76,7 @@ int shmem_unmap(void* map, uint32_t size)
 {
 	if (munmap(map, size) < 0)
 	{
-		printf("Error: Unable to unmap(0x%X, %d)!\n", (uint32_t)map, size);
+		printf("Error: Unable to unmap(%p, %d)!\n", map, size);
 		return 0;
 	}
 
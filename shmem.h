@@ -4,6 +4,13 @@
 #ifndef SHMEM_H
 #define SHMEM_H
 
+// shmem_map reads /dev/mem unless another source is selected.  A file
+// source is laid out like the physical memory starting at base, so the
+// ASCAL buffer lives at file offset MISTER_SCALER_BASEADDR - base.  Setting
+// MISTER_MEM=<path> in the environment selects a file with base 0x20000000.
+int shmem_set_source(const char *path, uint32_t base);
+void shmem_set_source_fd(int fd, uint32_t base);
+
 void *shmem_map(uint32_t address, uint32_t size);
 int shmem_unmap(void* map, uint32_t size);
 int shmem_put(uint32_t address, uint32_t size, void *buf);
@@ -0,0 +1,61 @@
+/*
+Bounded single producer, single consumer queue.  One thread pushes and one
+thread pops; neither takes a lock or allocates after construction, so a
+capture thread can hand frames to an encoder without ever blocking on it.
+*/
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <vector>
+
+template <typename T>
+class spsc_queue {
+public:
+   // capacity is rounded up to a power of two
+   explicit spsc_queue(size_t capacity) : head(0), tail(0) {
+      size_t n = 1;
+      while (n < capacity) n <<= 1;
+      slots.resize(n);
+      mask = n - 1;
+   }
+
+   spsc_queue(const spsc_queue &) = delete;
+   spsc_queue &operator=(const spsc_queue &) = delete;
+
+   // producer only, false when full
+   bool push(const T &v) {
+      size_t t = tail.load(std::memory_order_relaxed);
+      if (t - head.load(std::memory_order_acquire) > mask) return false;
+      slots[t & mask] = v;
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+   }
+
+   // consumer only, false when empty
+   bool pop(T &v) {
+      size_t h = head.load(std::memory_order_relaxed);
+      if (h == tail.load(std::memory_order_acquire)) return false;
+      v = slots[h & mask];
+      head.store(h + 1, std::memory_order_release);
+      return true;
+   }
+
+   // exact from either end, a snapshot from anywhere else
+   size_t size() const {
+      size_t h = head.load(std::memory_order_acquire);
+      return tail.load(std::memory_order_acquire) - h;
+   }
+   size_t capacity() const { return mask + 1; }
+
+private:
+   std::vector<T> slots;
+   size_t mask;
+   // head and tail on their own cache lines so the threads don't share one
+   alignas(64) std::atomic<size_t> head;
+   alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
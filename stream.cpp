@@ -0,0 +1,167 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <netdb.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stream.h"
+
+size_t stream_rle_encode(const uint8_t *src, size_t n, uint8_t *dst) {
+    uint8_t *out = dst;
+    size_t i = 0;
+    while (i < n) {
+        // a run of at least 3 is worth a repeat packet
+        size_t run = 1;
+        while (i + run < n && run < 128 && src[i + run] == src[i]) run++;
+        if (run >= 3) {
+            *out++ = (uint8_t)(257 - run);
+            *out++ = src[i];
+            i += run;
+            continue;
+        }
+        // literals up to the next run of 3
+        size_t start = i, len = 0;
+        while (i < n && len < 128) {
+            if (i + 2 < n && src[i] == src[i + 1] && src[i] == src[i + 2]) break;
+            i++;
+            len++;
+        }
+        *out++ = (uint8_t)(len - 1);
+        std::memcpy(out, src + start, len);
+        out += len;
+    }
+    return out - dst;
+}
+
+long stream_rle_decode(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    size_t i = 0, o = 0;
+    while (i < n) {
+        uint8_t c = src[i++];
+        if (c < 128) {
+            size_t len = c + 1;
+            if (i + len > n || o + len > cap) return -1;
+            std::memcpy(dst + o, src + i, len);
+            i += len;
+            o += len;
+        } else if (c > 128) {
+            size_t len = 257 - c;
+            if (i >= n || o + len > cap) return -1;
+            std::memset(dst + o, src[i++], len);
+            o += len;
+        }
+    }
+    return (long)o;
+}
+
+void stream_xor(const uint8_t *a, const uint8_t *b, uint8_t *dst, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        x ^= y;
+        std::memcpy(dst + i, &x, 8);
+    }
+    for (; i < n; i++) dst[i] = a[i] ^ b[i];
+}
+
+// Splits "[host:]port" for getaddrinfo, an empty host means any or localhost
+static struct addrinfo *resolve(const char *addr, bool passive) {
+    std::string s(addr), host, port;
+    size_t colon = s.rfind(':');
+    if (colon == std::string::npos) {
+        port = s;
+    } else {
+        host = s.substr(0, colon);
+        port = s.substr(colon + 1);
+    }
+
+    struct addrinfo hints, *res = nullptr;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (passive) hints.ai_flags = AI_PASSIVE;
+    int err = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res);
+    if (err) {
+        std::fprintf(stderr, "%s: %s\n", addr, gai_strerror(err));
+        return nullptr;
+    }
+    return res;
+}
+
+static bool unix_addr(const char *addr, struct sockaddr_un *sun) {
+    if (std::strncmp(addr, "unix:", 5)) return false;
+    std::memset(sun, 0, sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    std::strncpy(sun->sun_path, addr + 5, sizeof(sun->sun_path) - 1);
+    return true;
+}
+
+int stream_listen(const char *addr) {
+    struct sockaddr_un sun;
+    if (unix_addr(addr, &sun)) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        unlink(sun.sun_path);
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) || listen(fd, 1)) {
+            std::perror(addr);
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    struct addrinfo *res = resolve(addr, true);
+    if (!res) return -1;
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, 1)) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) std::perror(addr);
+    return fd;
+}
+
+int stream_connect(const char *addr) {
+    struct sockaddr_un sun;
+    if (unix_addr(addr, &sun)) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (struct sockaddr *)&sun, sizeof(sun))) {
+            std::perror(addr);
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    struct addrinfo *res = resolve(addr, false);
+    if (!res) return -1;
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        std::perror(addr);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
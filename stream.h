@@ -0,0 +1,57 @@
+/*
+Raw frame streaming between mister_stream on the MiSTer and mister_recv on
+another machine.  Every frame is a stream_header followed by its payload:
+the visible rows in the core's native pixel format (width*bpp bytes each),
+either as they are, PackBits RLE coded, or XORed with the previous frame
+sent and then RLE coded, which leaves mostly zero runs for game footage.
+All fields are little endian.
+*/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STREAM_MAGIC    "MSTR"
+#define STREAM_VERSION  1
+#define STREAM_PORT     7777
+
+enum {
+   STREAM_RAW = 0,
+   STREAM_RLE = 1,
+   STREAM_DELTA = 2   // XOR with the previous frame, then RLE
+};
+
+typedef struct __attribute__((packed)) {
+   char     magic[4];
+   uint8_t  version;
+   uint8_t  encoding;
+   uint8_t  format;     // ASCAL header byte 4
+   uint8_t  flags;      // ASCAL header byte 5
+   uint32_t frame;      // frames of the core since the stream started
+   uint32_t dropped;    // frames the server dropped for this client so far
+   uint64_t time_us;    // capture time since the stream started
+   uint16_t width;
+   uint16_t height;
+   uint16_t step;       // frames of the core between two frames sent
+   uint16_t reserved;
+   uint32_t size;       // payload bytes that follow
+} stream_header;
+
+// Worst case size of n bytes after stream_rle_encode
+static inline size_t stream_rle_bound(size_t n) { return n + n / 128 + 1; }
+
+// PackBits: a control byte c < 128 is followed by c+1 literal bytes, c > 128
+// repeats the next byte 257-c times.  Returns the coded size.
+size_t stream_rle_encode(const uint8_t *src, size_t n, uint8_t *dst);
+// Returns the decoded size, or -1 if the data is corrupt or exceeds cap
+long stream_rle_decode(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+// dst = a ^ b, dst may be either input
+void stream_xor(const uint8_t *a, const uint8_t *b, uint8_t *dst, size_t n);
+
+// Addresses are "unix:/path" or "[host:]port"; both return a socket or -1
+int stream_listen(const char *addr);
+int stream_connect(const char *addr);
+
+#endif
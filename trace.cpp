@@ -0,0 +1,113 @@
+#include <atomic>
+#include <cstdio>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+static trace_event events[TRACE_MAX_EVENTS];
+// never goes further past TRACE_MAX_EVENTS than the threads that got in
+// together, the spans that did not fit are counted on their own
+static std::atomic<int> next_event(0);
+static std::atomic<int64_t> dropped(0);
+
+int64_t trace_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int thread_id() {
+    static thread_local int tid = 0;
+    if (!tid) tid = (int)syscall(SYS_gettid);
+    return tid;
+}
+
+int trace_begin(const char *name) {
+    int span = next_event.load(std::memory_order_relaxed);
+    if (span < TRACE_MAX_EVENTS) span = next_event.fetch_add(1, std::memory_order_relaxed);
+    if (span >= TRACE_MAX_EVENTS) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+    trace_event *e = &events[span];
+    e->name = name;
+    e->tid = thread_id();
+    e->end_ns = 0;
+    e->begin_ns = trace_now_ns();
+    return span;
+}
+
+void trace_end(int span) {
+    if (span < 0 || span >= TRACE_MAX_EVENTS) return;
+    events[span].end_ns = trace_now_ns();
+}
+
+void trace_reset() {
+    next_event = 0;
+    dropped = 0;
+}
+
+int trace_count() {
+    int n = next_event;
+    return n < TRACE_MAX_EVENTS ? n : TRACE_MAX_EVENTS;
+}
+
+const trace_event *trace_events() {
+    return events;
+}
+
+// Nesting depth of span i, from the spans that enclose it
+static int depth(int i) {
+    int d = 0;
+    for (int j = 0; j < i; j++) {
+        if (events[j].tid == events[i].tid && events[j].begin_ns <= events[i].begin_ns &&
+            events[j].end_ns >= events[i].end_ns)
+            d++;
+    }
+    return d;
+}
+
+void trace_print(FILE *f) {
+    int n = trace_count();
+    if (!n) return;
+
+    // percentages are of the outermost spans
+    int64_t total = 0;
+    for (int i = 0; i < n; i++) {
+        if (events[i].end_ns && !depth(i)) total += events[i].end_ns - events[i].begin_ns;
+    }
+
+    int64_t start = events[0].begin_ns;
+    fprintf(f, "%-20s %10s %10s %6s\n", "stage", "start ms", "ms", "%");
+    for (int i = 0; i < n; i++) {
+        const trace_event *e = &events[i];
+        if (!e->end_ns) continue;
+        int64_t dur = e->end_ns - e->begin_ns;
+        fprintf(f, "%*s%-*s %10.3f %10.3f %5.1f%%\n", depth(i) * 2, "", 20 - depth(i) * 2, e->name,
+                (e->begin_ns - start) / 1e6, dur / 1e6, total ? 100.0 * dur / total : 0.0);
+    }
+    if (dropped)
+        fprintf(f, "(%lld spans dropped)\n", (long long)dropped);
+}
+
+int trace_write_chrome(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+
+    int pid = getpid();
+    fprintf(f, "{\"traceEvents\":[");
+    int n = trace_count();
+    bool first = true;
+    for (int i = 0; i < n; i++) {
+        const trace_event *e = &events[i];
+        if (!e->end_ns) continue;
+        fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                first ? "" : ",", e->name, e->begin_ns / 1e3, (e->end_ns - e->begin_ns) / 1e3,
+                pid, e->tid);
+        first = false;
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    return fclose(f) == 0;
+}
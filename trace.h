@@ -0,0 +1,47 @@
+/*
+Lightweight stage tracing.  Spans are monotonic timestamps written into a
+fixed size static buffer, so tracing is always compiled in and costs two
+clock reads per span; nothing is allocated.  The buffer can be printed as a
+breakdown or dumped as Chrome trace JSON (chrome://tracing, Perfetto).
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_MAX_EVENTS 256
+
+typedef struct {
+   const char *name;  // must be a string literal or otherwise outlive the trace
+   int64_t begin_ns;
+   int64_t end_ns;    // 0 while the span is open
+   int     tid;
+} trace_event;
+
+int64_t trace_now_ns();
+
+// Returns the span index, -1 once the buffer is full; those spans are only
+// counted, trace_reset starts over
+int  trace_begin(const char *name);
+void trace_end(int span);
+
+void trace_reset();
+int  trace_count();
+const trace_event *trace_events();
+
+void trace_print(FILE *f);
+int  trace_write_chrome(const char *path);
+
+class trace_scope {
+public:
+   explicit trace_scope(const char *name) : span(trace_begin(name)) {}
+   ~trace_scope() { trace_end(span); }
+   trace_scope(const trace_scope &) = delete;
+   trace_scope &operator=(const trace_scope &) = delete;
+private:
+   int span;
+};
+
+#endif
@@ -0,0 +1,1013 @@
+/*
+ * Copyright (c) 2001 Fabrice Bellard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file
+ * video encoding with libavcodec API example
+ *
+ * @example encode_video.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include <libavutil/opt.h>
+#include <libavutil/imgutils.h>
+}
+
+#include "../crt.h"
+#include "../scaler.h"
+#include "../spsc_queue.h"
+
+//const char *version = "$VER:ScreenShot" VDATE;
+
+// av_err2str() uses a compound literal, which C++ doesn't have
+static const char *av_error(int err)
+{
+    static char buf[128];
+    av_strerror(err, buf, sizeof(buf));
+    return buf;
+}
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int)
+{
+    running = 0;
+}
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    int64_t captured;   // frames read from the scaler
+    int64_t dropped;    // output frames that had no capture of their own
+    int64_t stalls;     // of those, frames lost because the pool was empty
+    int64_t duplicated; // sent again as the previous picture
+    int64_t torn;       // captures that still tore after the retries
+    int64_t repeats;    // frames identical to the last one, not converted
+    int64_t governed;   // slots the governor chose not to capture
+    int64_t packets;
+    int64_t bytes;
+    int64_t depth_sum;  // queue depth seen by each push, for the mean
+    int     depth_max;
+    double  encode_max; // slowest frame through the encoder, seconds
+    double  encode_sum;
+    int64_t encoded;
+} record_stats;
+
+// Frames go round between the two threads: capture takes one from the free
+// queue, converts the scaler buffer into it and pushes it to the encoder,
+// which hands it back once the next one has arrived.
+typedef struct {
+    mister_scaler *ms;
+    AVCodecContext *c;
+    AVFormatContext *oc;
+    AVStream *st;
+    AVPacket *pkt;
+    spsc_queue<AVFrame *> *free_frames;
+    spsc_queue<AVFrame *> *full_frames;
+    enum AVPixelFormat pix_fmt;
+    int align;          // of the frame rows, packed RGB is read without padding
+    FILE *raw;          // raw stream instead of c/oc
+    int y4m;            // raw stream gets YUV4MPEG2 frame headers
+    std::atomic<bool> capture_done;
+    int decimate;
+    double hz;
+    int64_t total;      // frames to record
+    int vfr;
+    int dedup;          // skip frames whose hash matches the last one
+    unsigned char *frame_copy; // with dedup, the frame read once to hash and convert
+    int auto_crop;      // look for the border again when the header changes
+    mister_crt *crt;    // upscale with scanlines, or NULL
+    unsigned char *crt_rgb; // its output for the 4:2:0 conversion
+    int crt_w, crt_h;
+    int64_t end_pts;    // slot after the last one, set when capture stops
+    double elapsed;
+    record_stats stats;
+
+    int pool;
+    int govern;                 // most the governor may decimate by, 0 = off
+    int fastest;                // fastest preset it may switch to, index into presets
+    int preset;                 // preset the encoder runs with, -1 when it has none
+    std::atomic<int> want_preset;   // set by the governor, applied by the encoder
+    std::atomic<int64_t> encode_us; // running totals for the governor
+    std::atomic<int64_t> encode_n;
+} recorder;
+
+// x264 and x265 presets from fast to slow, the governor steps along them
+static const char *presets[] = {
+    "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow"
+};
+#define NUM_PRESETS (int)(sizeof(presets)/sizeof(presets[0]))
+
+static int find_preset(const char *name)
+{
+    for (int i = 0; name && i < NUM_PRESETS; i++) {
+        if (!strcmp(name, presets[i]))
+            return i;
+    }
+    return -1;
+}
+
+// Adjusts how much work a frame costs once a second of slots, from what the
+// last second looked like: first a faster preset, then capturing only every
+// skip-th slot.  It backs off in the reverse order when there is room again.
+typedef struct {
+    int skip;
+    int start_preset;   // never slower than what the recording started with
+    int64_t window_end; // slot that closes the current window
+    int64_t stalls;     // totals when the window opened
+    int64_t encode_us;
+    int64_t encode_n;
+    int calm;           // windows in a row with room to spare
+} governor;
+
+static void encode(AVCodecContext *enc_ctx, AVFrame *frame, AVPacket *pkt,
+                   AVFormatContext *oc, AVStream *st, record_stats *stats)
+{
+    int ret;
+
+    /* send the frame to the encoder */
+    ret = avcodec_send_frame(enc_ctx, frame);
+    if (ret < 0) {
+        fprintf(stderr, "Error sending a frame for encoding: %s\n", av_error(ret));
+        exit(1);
+    }
+
+    while (ret >= 0) {
+        ret = avcodec_receive_packet(enc_ctx, pkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return;
+        else if (ret < 0) {
+            fprintf(stderr, "Error during encoding: %s\n", av_error(ret));
+            exit(1);
+        }
+
+        stats->packets++;
+        stats->bytes += pkt->size;
+        av_packet_rescale_ts(pkt, enc_ctx->time_base, st->time_base);
+        pkt->stream_index = st->index;
+        ret = av_interleaved_write_frame(oc, pkt);
+        if (ret < 0) {
+            fprintf(stderr, "Error writing a packet: %s\n", av_error(ret));
+            exit(1);
+        }
+    }
+}
+
+// Writes the planes of frame as they are, with a FRAME line for YUV4MPEG2
+static void write_raw(recorder *r, AVFrame *frame)
+{
+    int planes = r->pix_fmt == AV_PIX_FMT_RGB24 ? 1 : 3;
+    int bytes = r->pix_fmt == AV_PIX_FMT_RGB24 ? frame->width * 3 : frame->width;
+
+    if (r->y4m)
+        fputs("FRAME\n", r->raw);
+    for (int p = 0; p < planes; p++) {
+        for (int y = 0; y < frame->height; y++)
+            fwrite(frame->data[p] + y * frame->linesize[p], 1, bytes, r->raw);
+    }
+    r->stats.packets++;
+    r->stats.bytes += (int64_t)planes * bytes * frame->height;
+}
+
+static void emit(recorder *r, AVFrame *frame)
+{
+    if (r->raw)
+        write_raw(r, frame);
+    else
+        encode(r->c, frame, r->pkt, r->oc, r->st, &r->stats);
+}
+
+// Converts the scaler buffer into frame in the pixel format of the output
+static int convert_frame(recorder *r, AVFrame *frame)
+{
+    mister_scaler *ms = r->ms;
+    if (r->crt) {
+        if (r->pix_fmt == AV_PIX_FMT_RGB24)
+            return mister_scaler_read_crt(ms, r->crt, frame->data[0], frame->linesize[0]);
+        int torn = mister_scaler_read_crt(ms, r->crt, r->crt_rgb, r->crt_w * 3);
+        mister_rgb24_i420(r->crt_rgb, r->crt_w, r->crt_h, frame->linesize[0], frame->data[0],
+                          frame->linesize[1], frame->data[1], frame->linesize[2], frame->data[2]);
+        return torn;
+    }
+    switch (r->pix_fmt) {
+    case AV_PIX_FMT_RGB24:
+        return mister_scaler_read(ms, frame->data[0]);
+    case AV_PIX_FMT_BGR0:
+        return mister_scaler_read_32(ms, frame->data[0]);
+    case AV_PIX_FMT_YUV444P:
+        return mister_scaler_read_yuv(ms, frame->linesize[0], frame->data[0],
+                                      frame->linesize[1], frame->data[1],
+                                      frame->linesize[2], frame->data[2]);
+    case AV_PIX_FMT_GBRP:
+        return mister_scaler_read_gbrp(ms, frame->linesize[0], frame->data[0],
+                                       frame->linesize[1], frame->data[1],
+                                       frame->linesize[2], frame->data[2]);
+    default:
+        return mister_scaler_read_i420(ms, frame->linesize[0], frame->data[0],
+                                       frame->linesize[1], frame->data[1],
+                                       frame->linesize[2], frame->data[2]);
+    }
+}
+
+// Mirrors the last column and row when the core's size is odd, the encoder
+// frame is rounded up to whole chroma samples
+static void pad_odd(AVFrame *frame, int width, int height)
+{
+    if (width & 1) {
+        for (int y = 0; y < height; y++) {
+            uint8_t *row = frame->data[0] + y * frame->linesize[0];
+            row[width] = row[width - 1];
+        }
+    }
+    if (height & 1)
+        memcpy(frame->data[0] + height * frame->linesize[0],
+               frame->data[0] + (height - 1) * frame->linesize[0], frame->width);
+}
+
+// Like av_frame_make_writable() but without copying the old picture, which
+// gets overwritten anyway, when the encoder still holds on to the buffers
+static int writable_frame(AVFrame *frame, int align)
+{
+    if (av_frame_is_writable(frame))
+        return 0;
+    int format = frame->format, width = frame->width, height = frame->height;
+    av_frame_unref(frame);
+    frame->format = format;
+    frame->width  = width;
+    frame->height = height;
+    return av_frame_get_buffer(frame, align);
+}
+
+// Raises the calling thread to SCHED_FIFO, quietly stays put without the rights
+static void realtime_priority(int priority)
+{
+    struct sched_param sp;
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = priority;
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+}
+
+static void log_governor(recorder *r, int64_t slot, double load, int depth, int64_t stalls,
+                         const char *what)
+{
+    fprintf(stderr, "governor %.1f s: encode %.0f%% of the frame time, queue %d, %" PRId64 " stalls: %s\n",
+            slot * r->decimate / r->hz, 100 * load, depth, stalls, what);
+}
+
+static void govern(recorder *r, governor *g, int64_t slot)
+{
+    record_stats *stats = &r->stats;
+    int64_t us = r->encode_us, n = r->encode_n;
+    int64_t stalls = stats->stalls - g->stalls;
+    int depth = (int)r->full_frames->size();
+    /* time the encoder has per captured frame */
+    double budget = 1e6 * g->skip * r->decimate / r->hz;
+    double load = n > g->encode_n ? (double)(us - g->encode_us) / (n - g->encode_n) / budget : 0;
+    int preset = r->want_preset;
+    int64_t window = (int64_t)ceil(r->hz / r->decimate);
+    char what[64];
+
+    g->window_end = slot + window;
+    g->stalls = stats->stalls;
+    g->encode_us = us;
+    g->encode_n = n;
+
+    if (stalls || depth > r->pool / 2 || load > 0.9) {
+        g->calm = 0;
+        if (preset > r->fastest) {
+            r->want_preset = preset - 1;
+            snprintf(what, sizeof(what), "preset %s", presets[preset - 1]);
+        } else if (g->skip < r->govern) {
+            g->skip++;
+            snprintf(what, sizeof(what), "capturing every %d frames", g->skip * r->decimate);
+        } else {
+            if (stalls)
+                log_governor(r, slot, load, depth, stalls, "at its bounds, still dropping");
+            return;
+        }
+        log_governor(r, slot, load, depth, stalls, what);
+        /* the backlog takes a while to clear, judge the step a window later */
+        g->window_end += window;
+    } else if (load < 0.5 && depth <= 1) {
+        if (++g->calm < 3)
+            return;
+        g->calm = 0;
+        /* one frame more in skip frames raises the load by skip/(skip-1) */
+        if (g->skip > 1 && load * g->skip / (g->skip - 1) < 0.7) {
+            g->skip--;
+            snprintf(what, sizeof(what), "back to every %d frames", g->skip * r->decimate);
+        } else if (g->skip == 1 && preset >= 0 && preset < g->start_preset && load < 0.4) {
+            r->want_preset = preset + 1;
+            snprintf(what, sizeof(what), "back to preset %s", presets[preset + 1]);
+        } else {
+            return;
+        }
+        log_governor(r, slot, load, depth, stalls, what);
+    } else {
+        g->calm = 0;
+    }
+}
+
+// Vsync locked: wakes on every frame counter change and converts the frames
+// that are due straight into a pooled AVFrame.  It never waits on the
+// encoder; with no free frame the slot is dropped.
+static void capture_loop(recorder *r)
+{
+    mister_scaler *ms = r->ms;
+    record_stats *stats = &r->stats;
+    int width = ms->width, height = ms->height;
+    int out_w = r->crt ? r->crt_w : width, out_h = r->crt ? r->crt_h : height;
+    int64_t src = 0;        // frames of the core since the start
+    int64_t next_pts = 0;   // slot of the next recorded frame
+    uint64_t last_hash = 0;
+    bool have_hash = false;
+    governor g;
+
+    memset(&g, 0, sizeof(g));
+    g.skip = 1;
+    g.start_preset = r->preset;
+    g.window_end = (int64_t)ceil(r->hz / r->decimate);
+
+    realtime_priority(10);
+
+    /* start right on a frame boundary */
+    int fc = mister_scaler_wait_frame(ms, 1000);
+    double last = now_s();
+    double start = last;
+
+    while (running && next_pts < r->total) {
+        int64_t slot = src / r->decimate;
+        if (slot >= next_pts) {
+            if (slot >= r->total)
+                break;
+            /* whatever held us up cost whole frames */
+            stats->dropped += slot - next_pts;
+            next_pts = slot;
+
+            if (mister_scaler_refresh(ms)) {
+                /* the frame size must stay, the border may move within it */
+                if (r->auto_crop)
+                    mister_scaler_auto_crop(ms, MISTER_BORDER_LEVEL);
+                if (ms->width != width || ms->height != height) {
+                    fprintf(stderr, "The core switched to %dx%d, stopping\n", ms->width, ms->height);
+                    break;
+                }
+            }
+            if (r->govern && slot >= g.window_end)
+                govern(r, &g, slot);
+
+            /* a repeat only moves the clock on, the encoder shows the last
+             * picture for longer */
+            uint64_t hash = 0;
+            int torn = 0;
+            bool skip = g.skip > 1 && slot % g.skip;
+            if (r->dedup && !skip) {
+                /* one read of the uncached buffer, the hash and the
+                 * conversion both work on the cached copy, so the hash is
+                 * always that of the picture that gets encoded */
+                torn = mister_scaler_read_raw(ms, r->frame_copy);
+                hash = mister_frame_hash(r->frame_copy, ms->width, ms->height, &ms->pixfmt);
+            }
+
+            AVFrame *frame;
+            if (skip) {
+                /* like a repeat, but the picture may have moved on */
+                stats->governed++;
+            } else if (r->dedup && have_hash && hash == last_hash) {
+                stats->repeats++;
+            } else if (!r->free_frames->pop(frame)) {
+                stats->dropped++;
+                stats->stalls++;
+            } else if (writable_frame(frame, r->align) < 0) {
+                fprintf(stderr, "Could not make the frame writable\n");
+                break;
+            } else {
+                /* convert from the copy, or straight out of the ASCAL buffer
+                 * into the frame planes */
+                if (r->dedup)
+                    mister_scaler_set_frame(ms, r->frame_copy);
+                if (convert_frame(r, frame) || torn)
+                    stats->torn++;
+                mister_scaler_set_frame(ms, NULL);
+                if (r->pix_fmt == AV_PIX_FMT_YUV420P)
+                    pad_odd(frame, out_w, out_h);
+                stats->captured++;
+                frame->pts = next_pts;
+
+                int depth = (int)r->full_frames->size();
+                stats->depth_sum += depth;
+                if (depth > stats->depth_max)
+                    stats->depth_max = depth;
+                r->full_frames->push(frame);
+                last_hash = hash;
+                have_hash = true;
+            }
+            next_pts++;
+        }
+
+        int nfc = mister_scaler_wait_frame(ms, 1000);
+        if (nfc < 0) {
+            fprintf(stderr, "The frame counter stopped\n");
+            break;
+        }
+        double t = now_s();
+        src += mister_frames_between((nfc - fc) & 7, t - last, r->hz);
+        fc = nfc;
+        last = t;
+    }
+    r->elapsed = now_s() - start;
+    r->end_pts = next_pts;
+    r->capture_done = true;
+}
+
+// Drains the encoder and opens it again with the preset the governor asked
+// for.  Without B-frames, so the timestamps of the new one carry straight on.
+static void reopen_encoder(recorder *r, int preset)
+{
+    AVCodecContext *old = r->c;
+    encode(old, NULL, r->pkt, r->oc, r->st, &r->stats);
+
+    AVCodecContext *c = avcodec_alloc_context3(old->codec);
+    if (!c) {
+        fprintf(stderr, "Could not allocate video codec context\n");
+        exit(1);
+    }
+    c->bit_rate = old->bit_rate;
+    c->width = old->width;
+    c->height = old->height;
+    c->framerate = old->framerate;
+    c->time_base = old->time_base;
+    c->gop_size = old->gop_size;
+    c->max_b_frames = 0;
+    c->pix_fmt = old->pix_fmt;
+    c->flags = old->flags;
+    c->thread_count = old->thread_count;
+    c->thread_type = old->thread_type;
+    av_opt_set(c->priv_data, "preset", presets[preset], 0);
+
+    int ret = avcodec_open2(c, old->codec, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Could not reopen the codec with preset %s: %s\n", presets[preset], av_error(ret));
+        exit(1);
+    }
+    avcodec_free_context(&old);
+    r->c = c;
+    r->preset = preset;
+}
+
+// Encodes and muxes whatever capture queued.  The last picture is held back
+// so a gap in the timestamps can be filled with it for constant rate output.
+static void encode_loop(recorder *r)
+{
+    record_stats *stats = &r->stats;
+    AVFrame *prev = NULL;
+    AVFrame *frame;
+
+    for (;;) {
+        if (!r->full_frames->pop(frame)) {
+            if (r->capture_done && !r->full_frames->size())
+                break;
+            usleep(1000);
+            continue;
+        }
+
+        double t = now_s();
+        if (r->want_preset != r->preset)
+            reopen_encoder(r, r->want_preset);
+        if (prev && !r->vfr) {
+            for (int64_t pts = prev->pts + 1; pts < frame->pts; pts++) {
+                prev->pts = pts;
+                emit(r, prev);
+                stats->duplicated++;
+            }
+        }
+        emit(r, frame);
+        t = now_s() - t;
+        stats->encode_sum += t;
+        if (t > stats->encode_max)
+            stats->encode_max = t;
+        stats->encoded++;
+        r->encode_us += (int64_t)(t * 1e6);
+        r->encode_n++;
+
+        if (prev)
+            r->free_frames->push(prev);
+        prev = frame;
+    }
+    if (prev) {
+        /* repeats at the end still need their time on screen */
+        if (prev->pts < r->end_pts - 1) {
+            int64_t last_pts = r->end_pts - 1;
+            if (!r->vfr)
+                stats->duplicated += last_pts - prev->pts;
+            for (int64_t pts = r->vfr ? last_pts : prev->pts + 1; pts <= last_pts; pts++) {
+                prev->pts = pts;
+                emit(r, prev);
+            }
+        }
+        r->free_frames->push(prev);
+    }
+
+    /* flush the encoder */
+    if (!r->raw)
+        encode(r->c, NULL, r->pkt, r->oc, r->st, stats);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] <output file> <codec name> [seconds]\n"
+            "  codec    any libavcodec encoder, \"lossless\" for utvideo or ffv1,\n"
+            "           \"y4m\" for raw YUV4MPEG2 4:4:4 or \"rgb24\" for raw RGB\n"
+            "  output   \"-\" writes y4m or rgb24 to stdout\n"
+            "  -n N      record every Nth frame of the core (1)\n"
+            "  -r HZ     refresh rate of the core (measured)\n"
+            "  -b BPS    bit rate (400000)\n"
+            "  -q N      frames in the pool between capture and encoder (8)\n"
+            "  -a        convert and encode frames identical to the last one\n"
+            "  -d        repeat the previous picture for dropped frames even\n"
+            "            when the container takes gaps in the timestamps\n"
+            "  -g N      when the encoder falls behind, switch to faster presets\n"
+            "            and then capture down to every Nth frame (off)\n"
+            "  -p NAME   fastest preset the governor may use (veryfast)\n"
+            "  -c RECT   record only WxH+X+Y of the frame, or auto to leave out\n"
+            "            a black border\n"
+            "  -i MODE   interlaced cores: weave each field with the one before,\n"
+            "            double its lines, or off (off)\n"
+            "  -C SCALE[,SCANLINE[,BLUR]]  upscale by SCALE with scanlines SCANLINE\n"
+            "            percent darker (40) and BLUR percent of horizontal blur (0),\n"
+            "            for rgb24 and the 4:2:0 codecs\n",
+            prog);
+}
+
+// The frame rates the encoder is limited to, NULL for any.  The AVCodec field
+// is deprecated since libavcodec 61.13.
+static const AVRational *supported_framerates(const AVCodecContext *c, const AVCodec *codec)
+{
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(61, 13, 100)
+    const void *rates = NULL;
+    int n = 0;
+    if (avcodec_get_supported_config(c, codec, AV_CODEC_CONFIG_FRAME_RATE, 0, &rates, &n) < 0)
+        return NULL;
+    return (const AVRational *)rates;
+#else
+    (void)c;
+    return codec->supported_framerates;
+#endif
+}
+
+// Cheapest lossless intra codec that libavcodec was built with
+static const AVCodec *find_lossless()
+{
+    static const char *names[] = { "utvideo", "ffv1" };
+    for (unsigned i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+        const AVCodec *codec = avcodec_find_encoder_by_name(names[i]);
+        if (codec)
+            return codec;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    const char *filename, *codec_name;
+    const AVCodec *codec = NULL;
+    AVCodecContext *c= NULL;
+    AVFormatContext *oc = NULL;
+    AVStream *st = NULL;
+    FILE *raw = NULL;
+    int ret;
+    AVPacket *pkt = NULL;
+    int seconds=10;
+    int pool = 8;
+    int dedup = 1;
+    int decimate = 1;
+    double hz = 0;
+    int64_t bit_rate = 400000;
+    int vfr = -1;
+    enum AVPixelFormat pix_fmt = AV_PIX_FMT_YUV420P;
+    int align = 32;
+    int y4m = 0;
+    int govern = 0;
+    int fastest = find_preset("veryfast");
+    int deinterlace = MISTER_DEINTERLACE_OFF;
+    const char *crop = NULL;
+    int crop_x = 0, crop_y = 0, crop_w = 0, crop_h = 0;
+    int crt = 0;
+    mister_crt_opts crt_opts;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:b:q:adg:p:c:i:C:h")) != -1) {
+        switch (opt) {
+        case 'n': decimate = atoi(optarg); break;
+        case 'r': hz = atof(optarg); break;
+        case 'b': bit_rate = atoll(optarg); break;
+        case 'q': pool = atoi(optarg); break;
+        case 'a': dedup = 0; break;
+        case 'd': vfr = 0; break;
+        case 'g': govern = atoi(optarg); break;
+        case 'p':
+            fastest = find_preset(optarg);
+            if (fastest < 0) {
+                fprintf(stderr, "Unknown preset %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'c':
+            crop = optarg;
+            if (strcmp(crop, "auto") && mister_roi_parse(crop, &crop_x, &crop_y, &crop_w, &crop_h)) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'i':
+            deinterlace = mister_deinterlace_parse(optarg);
+            if (deinterlace < 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'C':
+            if (mister_crt_parse(optarg, &crt_opts)) {
+                usage(argv[0]);
+                exit(1);
+            }
+            crt = 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind < 2 || decimate < 1 || hz < 0 || pool < 2 || govern < 0) {
+        usage(argv[0]);
+        exit(0);
+    }
+    filename = argv[optind];
+    codec_name = argv[optind + 1];
+    if (argc - optind > 2)
+        seconds = atoi(argv[optind + 2]);
+
+    if (!strcmp(codec_name, "y4m")) {
+        /* 4:4:4 so only the YUV rounding is lost */
+        pix_fmt = AV_PIX_FMT_YUV444P;
+        y4m = 1;
+    } else if (!strcmp(codec_name, "rgb24")) {
+        /* mister_scaler_read() writes packed rows */
+        pix_fmt = AV_PIX_FMT_RGB24;
+        align = 1;
+    }
+
+    if (pix_fmt == AV_PIX_FMT_YUV420P) {
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+        av_register_all();
+#endif
+        codec = !strcmp(codec_name, "lossless") ? find_lossless() : avcodec_find_encoder_by_name(codec_name);
+        if (!codec) {
+            fprintf(stderr, "Codec '%s' not found\n", codec_name);
+            exit(1);
+        }
+        /* RGB without loss: utvideo codes planar RGB, ffv1 takes 8 bit RGB
+         * only packed, read_32 writes it as B, G, R, 0xFF */
+        if (codec->id == AV_CODEC_ID_UTVIDEO) {
+            pix_fmt = AV_PIX_FMT_GBRP;
+        } else if (codec->id == AV_CODEC_ID_FFV1) {
+            pix_fmt = AV_PIX_FMT_BGR0;
+            align = 1;
+        }
+
+        avformat_alloc_output_context2(&oc, NULL, NULL, filename);
+        if (!oc) {
+            fprintf(stderr, "Could not deduce the container from %s\n", filename);
+            exit(1);
+        }
+
+        c = avcodec_alloc_context3(codec);
+        if (!c) {
+            fprintf(stderr, "Could not allocate video codec context\n");
+            exit(1);
+        }
+
+        pkt = av_packet_alloc();
+        if (!pkt)
+            exit(1);
+    } else {
+        raw = !strcmp(filename, "-") ? stdout : fopen(filename, "wb");
+        if (!raw) {
+            fprintf(stderr, "Could not open %s\n", filename);
+            exit(1);
+        }
+        /* a raw stream has no timestamps */
+        vfr = 0;
+    }
+
+
+    mister_scaler *ms=mister_scaler_init();
+    if (ms==NULL)
+    {
+            fprintf(stderr, "some problem with the mister scaler, maybe this core doesn't support it\n");
+            exit(0);
+    }
+    if (deinterlace)
+        mister_scaler_set_deinterlace(ms, deinterlace);
+    int auto_crop = crop && !strcmp(crop, "auto");
+    if (auto_crop && mister_scaler_auto_crop(ms, MISTER_BORDER_LEVEL))
+        crop = NULL;
+    else if (crop && !auto_crop)
+        mister_scaler_set_roi(ms, crop_x, crop_y, crop_w, crop_h);
+    if (crop) {
+        fprintf(stderr, "Cropped to %dx%d+%d+%d of %dx%d\n", ms->width, ms->height,
+                ms->crop_x, ms->crop_y, ms->frame_width, ms->frame_height);
+    }
+
+    /* the upscale writes RGB rows, the 4:2:0 codecs get them converted */
+    mister_crt *up = NULL;
+    unsigned char *crt_rgb = NULL;
+    if (crt) {
+        if (pix_fmt != AV_PIX_FMT_RGB24 && pix_fmt != AV_PIX_FMT_YUV420P) {
+            fprintf(stderr, "-C needs rgb24 or a 4:2:0 codec\n");
+            exit(1);
+        }
+        up = mister_crt_create(ms->width, ms->height, &crt_opts);
+        if (pix_fmt == AV_PIX_FMT_YUV420P)
+            crt_rgb = (unsigned char *)malloc((size_t)ms->width * crt_opts.scale * ms->height * crt_opts.scale * 3);
+        if (!up || (pix_fmt == AV_PIX_FMT_YUV420P && !crt_rgb)) {
+            fprintf(stderr, "Could not upscale %dx%d by %d\n", ms->width, ms->height, crt_opts.scale);
+            exit(1);
+        }
+        fprintf(stderr, "Upscaled by %d, scanlines %d%%, blur %d%%\n", crt_opts.scale,
+                crt_opts.scanline, crt_opts.blur);
+    }
+
+    if (hz == 0) {
+        hz = mister_scaler_measure_refresh(ms, 30);
+        if (hz == 0) {
+            fprintf(stderr, "The frame counter doesn't move, is the core running?\n");
+            exit(1);
+        }
+    }
+
+    int preset = -1;
+    int width = ms->width, height = ms->height;
+    if (up) {
+        width *= crt_opts.scale;
+        height *= crt_opts.scale;
+    }
+    /* 4:2:0 needs a multiple of two */
+    if (pix_fmt == AV_PIX_FMT_YUV420P) {
+        width = (width + 1) & ~1;
+        height = (height + 1) & ~1;
+    }
+    AVRational framerate = av_d2q(hz / decimate, 100000);
+
+    if (raw && y4m) {
+        fprintf(raw, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n", width, height, framerate.num, framerate.den);
+    } else if (raw) {
+        fprintf(stderr, "rgb24 %dx%d at %d/%d fps\n", width, height, framerate.num, framerate.den);
+    } else {
+        /* put sample parameters */
+        c->bit_rate = bit_rate;
+        c->width = width;
+        c->height = height;
+        /* one tick per recorded frame, codecs with a fixed list of rates get
+         * the closest one and drift slightly */
+        c->framerate = framerate;
+        const AVRational *rates = supported_framerates(c, codec);
+        if (rates)
+            c->framerate = rates[av_find_nearest_q_idx(c->framerate, rates)];
+        c->time_base = av_inv_q(c->framerate);
+
+        /* emit one intra frame every ten frames
+         * check frame pict_type before passing frame
+         * to encoder, if frame->pict_type is AV_PICTURE_TYPE_I
+         * then gop_size is ignored and the output of encoder
+         * will always be I frame irrespective to gop_size
+         */
+        c->gop_size = 10;
+        c->max_b_frames = 1;
+        c->pix_fmt = pix_fmt;
+        if (oc->oformat->flags & AVFMT_GLOBALHEADER)
+            c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+        if (codec->id == AV_CODEC_ID_H264)
+            av_opt_set(c->priv_data, "preset", "slow", 0);
+
+        /* lossless codecs are intra only and split the picture into slices
+         * coded on all cores */
+        if (pix_fmt == AV_PIX_FMT_GBRP || pix_fmt == AV_PIX_FMT_BGR0) {
+            c->gop_size = 1;
+            c->max_b_frames = 0;
+            c->thread_count = 0;
+            c->thread_type = FF_THREAD_SLICE;
+        }
+        if (codec->id == AV_CODEC_ID_FFV1) {
+            /* slices need version 3 */
+            c->level = 3;
+            c->slices = 4;
+            av_opt_set(c->priv_data, "slicecrc", "0", 0);
+        }
+
+        /* open it */
+        ret = avcodec_open2(c, codec, NULL);
+        if (ret < 0) {
+            fprintf(stderr, "Could not open codec: %s\n", av_error(ret));
+            exit(1);
+        }
+
+        /* the governor can only change the preset of an encoder that puts
+         * its headers in the stream, reopening it changes them */
+        uint8_t *name = NULL;
+        if (govern && !(c->flags & AV_CODEC_FLAG_GLOBAL_HEADER) &&
+            av_opt_get(c->priv_data, "preset", 0, &name) >= 0) {
+            preset = find_preset((const char *)name);
+            av_free(name);
+        }
+
+        st = avformat_new_stream(oc, NULL);
+        if (!st) {
+            fprintf(stderr, "Could not allocate the stream\n");
+            exit(1);
+        }
+        st->time_base = c->time_base;
+        st->avg_frame_rate = c->framerate;
+        ret = avcodec_parameters_from_context(st->codecpar, c);
+        if (ret < 0) {
+            fprintf(stderr, "Could not copy the stream parameters: %s\n", av_error(ret));
+            exit(1);
+        }
+
+        if (!(oc->oformat->flags & AVFMT_NOFILE)) {
+            ret = avio_open(&oc->pb, filename, AVIO_FLAG_WRITE);
+            if (ret < 0) {
+                fprintf(stderr, "Could not open %s: %s\n", filename, av_error(ret));
+                exit(1);
+            }
+        }
+        ret = avformat_write_header(oc, NULL);
+        if (ret < 0) {
+            fprintf(stderr, "Could not write the header: %s\n", av_error(ret));
+            exit(1);
+        }
+
+        /* containers that can't carry a gap in the timestamps get the previous
+         * picture again for a frame we missed, like ffmpeg's cfr mode */
+        if (vfr < 0)
+            vfr = (oc->oformat->flags & AVFMT_VARIABLE_FPS) && !(oc->oformat->flags & AVFMT_NOTIMESTAMPS);
+    }
+
+    /* encoder holds one back as the previous picture, capture fills one */
+    std::vector<AVFrame *> frames(pool);
+    spsc_queue<AVFrame *> free_frames(pool);
+    spsc_queue<AVFrame *> full_frames(pool);
+    for (int i = 0; i < pool; i++) {
+        AVFrame *frame = av_frame_alloc();
+        if (!frame) {
+            fprintf(stderr, "Could not allocate video frame\n");
+            exit(1);
+        }
+        frame->format = pix_fmt;
+        frame->width  = width;
+        frame->height = height;
+        ret = av_frame_get_buffer(frame, align);
+        if (ret < 0) {
+            fprintf(stderr, "Could not allocate the video frame data\n");
+            exit(1);
+        }
+        frames[i] = frame;
+        free_frames.push(frame);
+    }
+
+    recorder r;
+    memset(&r.stats, 0, sizeof(r.stats));
+    r.ms = ms;
+    r.c = c;
+    r.oc = oc;
+    r.st = st;
+    r.pkt = pkt;
+    r.free_frames = &free_frames;
+    r.full_frames = &full_frames;
+    r.pix_fmt = pix_fmt;
+    r.align = align;
+    r.raw = raw;
+    r.y4m = y4m;
+    r.capture_done = false;
+    r.decimate = decimate;
+    r.hz = hz;
+    r.total = llround(seconds * hz / decimate);
+    r.vfr = vfr;
+    r.dedup = dedup;
+    /* any pixel format the header may switch to at this size */
+    r.frame_copy = dedup ? (unsigned char *)malloc((size_t)ms->width * ms->height * 4) : NULL;
+    if (dedup && !r.frame_copy) {
+        fprintf(stderr, "Could not allocate the frame copy\n");
+        exit(1);
+    }
+    r.auto_crop = auto_crop;
+    r.crt = up;
+    r.crt_rgb = crt_rgb;
+    r.crt_w = ms->width * (up ? crt_opts.scale : 1);
+    r.crt_h = ms->height * (up ? crt_opts.scale : 1);
+    r.end_pts = 0;
+    r.elapsed = 0;
+    r.pool = pool;
+    r.govern = govern;
+    r.fastest = fastest;
+    r.preset = preset;
+    r.want_preset = preset;
+    r.encode_us = 0;
+    r.encode_n = 0;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    fprintf(stderr, "Recording %dx%d at %.3f Hz / %d to %s\n", ms->width, ms->height, hz, decimate, filename);
+    if (govern)
+        fprintf(stderr, "Governor: down to every %d frames%s%s\n", govern * decimate,
+                preset >= 0 ? ", presets down to " : "", preset >= 0 ? presets[fastest] : "");
+
+    std::thread encoder(encode_loop, &r);
+    capture_loop(&r);
+    encoder.join();
+    if (raw) {
+        if (raw != stdout)
+            fclose(raw);
+        else
+            fflush(stdout);
+    } else {
+        av_write_trailer(oc);
+    }
+
+    record_stats *stats = &r.stats;
+    fprintf(stderr,
+            "%" PRId64 " frames in %.2f s: %" PRId64 " captured (%.2f fps of %.2f), "
+            "%" PRId64 " repeats, %" PRId64 " governed, %" PRId64 " dropped, %" PRId64 " duplicated, "
+            "%" PRId64 " torn, %" PRId64 " bytes\n",
+            r.end_pts, r.elapsed, stats->captured,
+            r.elapsed > 0 ? stats->captured / r.elapsed : 0.0, hz / decimate,
+            stats->repeats, stats->governed, stats->dropped, stats->duplicated, stats->torn,
+            stats->bytes);
+    fprintf(stderr,
+            "queue: %d frames, depth mean %.2f max %d, %" PRId64 " stalls on an empty pool; "
+            "encode mean %.2f ms max %.2f ms\n",
+            pool, stats->captured ? (double)stats->depth_sum / stats->captured : 0.0,
+            stats->depth_max, stats->stalls,
+            stats->encoded ? 1000 * stats->encode_sum / stats->encoded : 0.0,
+            1000 * stats->encode_max);
+
+    if (oc && !(oc->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&oc->pb);
+    avformat_free_context(oc);
+    /* the governor may have reopened it */
+    avcodec_free_context(&r.c);
+    for (AVFrame *frame : frames)
+        av_frame_free(&frame);
+    av_packet_free(&pkt);
+    mister_crt_free(up);
+    free(crt_rgb);
+    free(r.frame_copy);
+    mister_scaler_free(ms);
+
+    return 0;
+}